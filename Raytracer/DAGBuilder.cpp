@@ -0,0 +1,621 @@
+#include "DAGBuilder.h"
+#include "Morton.h"
+#include <cassert>
+#include <bit>
+#include <atomic>
+#include <iostream>
+#include <filesystem>
+#include <random>
+#include <map>
+#include <algorithm>
+#include <iterator>
+#include "VoxLoader.h"
+#include "Terrain.h"
+
+static uint32_t keyOf(uint64_t entry) { return uint32_t(entry >> 32); }
+
+// LSD radix sort on the upper 32 bits. Stable, so that the last of several
+// voxels set at the same position stays last.
+static void radixSort(std::vector<uint64_t>& entries, int keyBits) {
+	std::vector<uint64_t> buffer(entries.size());
+	for (int shift = 32; shift < 32 + keyBits; shift += 8) {
+		size_t offsets[257] = { 0 };
+		for (auto entry : entries) offsets[((entry >> shift) & 255) + 1]++;
+		for (int i = 0; i < 256; i++) offsets[i + 1] += offsets[i];
+		for (auto entry : entries) buffer[offsets[(entry >> shift) & 255]++] = entry;
+		entries.swap(buffer);
+	}
+}
+
+DAGBuilder::DAGBuilder(size_t size, const Options& options) :
+	options(options), levels(std::bit_width(std::bit_ceil(size)) - 1) {
+	assert(levels <= 16);
+	static_assert((size_t(1) << 16) <= SVDAG::MaxRootSize, "the shader can't trace every SVDAG that is built");
+	this->options.threads = std::max(options.threads, 1u);
+	// Sort keys are 32 bits, so resolve everything above the lowest 10 levels with
+	// buckets. Use at least 3 levels (512 buckets) to have enough work to spread
+	// over the threads.
+	bucketLevels = std::min(levels, std::max(3, levels - 10));
+	buckets.resize(size_t(1) << (3 * bucketLevels));
+	// Chunks are one bucket unless they are given a size. They only keep state while they
+	// have voxels, so they can be smaller than a bucket, but the index of a chunk is 32 bits.
+	chunkLevels = levels - bucketLevels;
+	if (options.chunkSize) {
+		chunkLevels = std::clamp(int(std::bit_width(std::bit_ceil(options.chunkSize))) - 1, std::max(0, levels - 10), levels);
+	}
+	emptyMaterial = material({ {0, 0, 0} });
+	if (options.format.geometryOnly && options.format.symmetry) {
+		std::cerr << "Mirrored subtrees can't be merged in a geometry only SVDAG" << std::endl;
+		this->options.format.symmetry = false;
+	}
+}
+
+uint32_t DAGBuilder::intern(NodeTable& table, const DAGNode& node) const {
+	return options.format.symmetry ? table.internSymmetric(node) : table.intern(node);
+}
+
+uint32_t DAGBuilder::material(const SVO::Material& material) {
+	assert(!reducing);
+	auto [it, inserted] = materialToId.try_emplace(material, uint32_t(materials.size()));
+	if (inserted) materials.push_back(material);
+	return it->second;
+}
+
+void DAGBuilder::set(uint32_t x, uint32_t y, uint32_t z, uint32_t material) {
+	assert(x < getSize() && y < getSize() && z < getSize());
+	const auto code = morton(x, y, z);
+	const int localBits = 3 * (levels - bucketLevels);
+	const auto local = code & ((uint64_t(1) << localBits) - 1);
+	buckets[code >> localBits].push_back(local << 32 | material);
+}
+
+uint32_t DAGBuilder::addModel(std::vector<Voxel> voxels) {
+	models.push_back(std::move(voxels));
+	return uint32_t(models.size() - 1);
+}
+
+void DAGBuilder::placeModel(uint32_t id, uint32_t x, uint32_t y, uint32_t z, int level) {
+	assert(!reducing && x % (1u << level) == 0 && y % (1u << level) == 0 && z % (1u << level) == 0);
+	if (options.format.geometryOnly) {
+		// the attributes are collected from the voxels of every bucket
+		for (auto& voxel : models[id]) set(voxel.x + x, voxel.y + y, voxel.z + z, voxel.material);
+		return;
+	}
+	placements.push_back({ id, x, y, z, level });
+}
+
+void DAGBuilder::parallelFor(size_t count, const std::function<void(size_t i, unsigned thread)>& task) {
+	std::atomic<size_t> next = 0, done = 0;
+	if (options.progress) *options.progress = 0;
+	auto worker = [&](unsigned thread) {
+		for (size_t i; (i = next++) < count;) {
+			task(i, thread);
+			if (options.progress) options.progress->store(float(++done) / float(count), std::memory_order_relaxed);
+		}
+	};
+	std::vector<std::thread> workers;
+	for (unsigned t = 1; t < options.threads; t++) workers.emplace_back(worker, t);
+	worker(0);
+	for (auto& w : workers) w.join();
+}
+
+struct DAGBuilder::ColumnTile {
+	static constexpr uint32_t Mixed = UINT32_MAX;
+	// of the spans over a square of columns
+	struct Cell {
+		uint32_t minTops[ColumnSpans::MaxSpans], maxTops[ColumnSpans::MaxSpans];
+		uint32_t materials[ColumnSpans::MaxSpans]; // Mixed if they aren't the same
+	};
+	int spanCount;
+	int levels;
+	std::vector<std::vector<Cell>> cells; // squares of 2^level columns by level, x major
+	const Cell& at(int level, uint32_t x, uint32_t z) const { return cells[level][(size_t(x) << (levels - level)) + z]; }
+
+	NodeTable* table;
+	uint64_t first; // Morton code of the first voxel of the chunk
+	uint64_t voxels; // in the chunk so far
+	std::vector<std::pair<uint32_t, uint32_t>> runs; // of the chunk, with format.geometryOnly
+	std::vector<std::pair<uint64_t, uint32_t>>* verifyVoxels;
+};
+
+void DAGBuilder::buildColumns(int size, int spanCount, const std::function<void(int x, int z0, int z1, ColumnSpans* spans)>& columns) {
+	assert(spanCount <= ColumnSpans::MaxSpans);
+	// every tile is a column of chunks
+	const int tiles = 1 << (levels - chunkLevels), tileSize = 1 << chunkLevels;
+	startReducing();
+	columnsBuilt = true;
+	rootLevels = chunkLevels;
+	parallelFor(size_t(tiles) * tiles, [&](size_t t, unsigned thread) {
+		ColumnTile tile{ spanCount, chunkLevels, std::vector<std::vector<ColumnTile::Cell>>(chunkLevels + 1) };
+		tile.table = &tables[thread];
+		tile.verifyVoxels = options.verify ? &verifyVoxels[thread] : nullptr;
+		const int x0 = int(t / tiles) * tileSize, z0 = int(t % tiles) * tileSize;
+		// columns outside of `size` are empty
+		std::vector<ColumnSpans> spans(tileSize, ColumnSpans{});
+		auto& cells = tile.cells[0];
+		cells.resize(size_t(tileSize) * tileSize);
+		for (int x = 0; x < tileSize; x++) {
+			if (x0 + x < size && z0 < size) columns(x0 + x, z0, std::min(size, z0 + tileSize), spans.data());
+			for (int z = 0; z < tileSize; z++) {
+				auto& cell = cells[size_t(x) * tileSize + z];
+				for (int k = 0; k < spanCount; k++) {
+					const bool inside = x0 + x < size && z0 + z < size;
+					cell.minTops[k] = cell.maxTops[k] = inside ? spans[z].tops[k] : 0;
+					cell.materials[k] = inside ? spans[z].materials[k] : emptyMaterial;
+				}
+			}
+		}
+		for (int level = 1; level <= chunkLevels; level++) {
+			const uint32_t side = uint32_t(tileSize) >> level;
+			tile.cells[level].resize(size_t(side) * side);
+			for (uint32_t x = 0; x < side; x++)
+				for (uint32_t z = 0; z < side; z++) {
+					auto& cell = tile.cells[level][size_t(x) * side + z];
+					cell = tile.at(level - 1, x * 2, z * 2);
+					for (int i = 1; i < 4; i++) {
+						const auto& quarter = tile.at(level - 1, x * 2 + (i >> 1), z * 2 + (i & 1));
+						for (int k = 0; k < spanCount; k++) {
+							cell.minTops[k] = std::min(cell.minTops[k], quarter.minTops[k]);
+							cell.maxTops[k] = std::max(cell.maxTops[k], quarter.maxTops[k]);
+							if (cell.materials[k] != quarter.materials[k]) cell.materials[k] = ColumnTile::Mixed;
+						}
+					}
+				}
+		}
+
+		for (uint32_t y = 0; y < uint32_t(tiles); y++) {
+			const auto chunk = uint32_t(morton(uint32_t(t / tiles), y, uint32_t(t % tiles)));
+			tile.first = uint64_t(chunk) << 3 * chunkLevels;
+			tile.voxels = 0;
+			const uint32_t root = columnNode(tile, chunkLevels, 0, y * tileSize, 0, 0);
+			if (root != UINT32_MAX) threadRoots[thread].push_back({ chunk, root });
+			if (options.format.geometryOnly && tile.voxels) {
+				threadAttributes[thread].push_back({ chunk, uint32_t(tile.voxels), std::move(tile.runs) });
+				tile.runs.clear();
+			}
+		}
+		if (options.chunkSize) spill(thread);
+	});
+}
+
+uint32_t DAGBuilder::columnNode(ColumnTile& tile, int level, uint32_t x, uint32_t y, uint32_t z, uint32_t code) {
+	const auto& cell = tile.at(level, x, z);
+	const uint32_t size = 1u << level;
+	for (int k = 0; k <= tile.spanCount; k++) {
+		const uint32_t below = k ? cell.maxTops[k - 1] : 0;
+		const uint32_t above = k < tile.spanCount ? cell.minTops[k] : UINT32_MAX;
+		if (below > y || above < y + size) continue;
+		if (k == tile.spanCount) return UINT32_MAX;
+		if (cell.materials[k] != ColumnTile::Mixed) return filledNode(tile, cell.materials[k], level, code);
+		break;
+	}
+	// a single column always has one material per span
+	assert(level > 0);
+	DAGNode node;
+	node.material = emptyMaterial;
+	int cnt = 0;
+	for (uint32_t i = 0; i < 8; i++) {
+		const uint32_t child = columnNode(tile, level - 1, x * 2 + (i >> 2), y + (i >> 1 & 1) * size / 2, z * 2 + (i & 1), code | i << 3 * (level - 1));
+		if (child == UINT32_MAX) continue;
+		node.bitmask |= 1 << i;
+		node.children[cnt++] = child;
+	}
+	return cnt ? intern(*tile.table, node) : UINT32_MAX;
+}
+
+uint32_t DAGBuilder::filledNode(ColumnTile& tile, uint32_t material, int level, uint32_t code) {
+	const uint64_t voxels = uint64_t(1) << 3 * level;
+	if (options.format.geometryOnly) {
+		auto& runs = tile.runs;
+		if (runs.empty() || runs.back().second != material) runs.push_back({ uint32_t(tile.voxels), material });
+	}
+	if (tile.verifyVoxels) {
+		for (uint64_t c = code; c < code + voxels; c++) tile.verifyVoxels->push_back({ tile.first + c, material });
+	}
+	tile.voxels += voxels;
+	// a filled cube is collapsed into a single filled node, see NodeTable::intern
+	return tile.table->leaf(options.format.geometryOnly ? emptyMaterial : material);
+}
+
+// Takes sorted (key << 32 | node id) entries and replaces every group of
+// siblings with an entry for their parent, `levels` times.
+void DAGBuilder::reduce(std::vector<uint64_t>& entries, int levels, NodeTable& table) {
+	for (int level = 0; level < levels; level++) {
+		size_t out = 0;
+		for (size_t i = 0; i < entries.size();) {
+			const uint32_t parent = keyOf(entries[i]) >> 3;
+			DAGNode node;
+			node.material = emptyMaterial;
+			int cnt = 0;
+			for (; i < entries.size() && keyOf(entries[i]) >> 3 == parent; i++) {
+				node.bitmask |= 1 << (keyOf(entries[i]) & 7);
+				node.children[cnt++] = uint32_t(entries[i]);
+			}
+			entries[out++] = uint64_t(parent) << 32 | intern(table, node);
+		}
+		entries.resize(out);
+	}
+}
+
+void DAGBuilder::startReducing() {
+	if (reducing) return;
+	reducing = true;
+	if (options.format.geometryOnly && materials.size() > 1 << 16) {
+		std::cerr << "Too many materials for a geometry only SVDAG, storing them in the nodes" << std::endl;
+		options.format.geometryOnly = false;
+	}
+	tables = std::vector<NodeTable>(options.threads);
+	threadRoots.resize(options.threads);
+	spillFiles.resize(options.threads);
+	spillStreams.resize(options.threads);
+	rootLevels = levels - bucketLevels;
+	roots.clear();
+	verifyVoxels.assign(options.verify ? options.threads : 0, {});
+	threadAttributes.assign(options.format.geometryOnly ? options.threads : 0, {});
+}
+
+void DAGBuilder::reduceBucket(size_t b, unsigned thread) {
+	const int localLevels = levels - bucketLevels;
+	const bool geometryOnly = options.format.geometryOnly;
+	auto& entries = buckets[b];
+	auto& table = tables[thread];
+	if (columnsBuilt) {
+		std::cerr << "Voxels set in a frame built from columns are ignored" << std::endl;
+		std::vector<uint64_t>().swap(entries);
+		return;
+	}
+	radixSort(entries, 3 * localLevels);
+	// drop voxels overwritten by a later one
+	size_t n = 0;
+	for (auto entry : entries) {
+		if (n && keyOf(entries[n - 1]) == keyOf(entry)) n--;
+		entries[n++] = entry;
+	}
+	entries.resize(n);
+	if (options.verify) {
+		for (auto entry : entries) verifyVoxels[thread].push_back({ uint64_t(b) << 3 * localLevels | keyOf(entry), uint32_t(entry) });
+	}
+	if (geometryOnly) {
+		Attributes bucket{ uint32_t(b), uint32_t(n), {} };
+		for (size_t i = 0; i < n; i++) {
+			if (!i || uint32_t(entries[i]) != uint32_t(entries[i - 1])) bucket.runs.push_back({ uint32_t(i), uint32_t(entries[i]) });
+		}
+		threadAttributes[thread].push_back(std::move(bucket));
+	}
+	for (auto& entry : entries) {
+		entry = uint64_t(keyOf(entry)) << 32 | table.leaf(geometryOnly ? emptyMaterial : uint32_t(entry));
+	}
+	reduce(entries, localLevels, table);
+	assert(entries.size() == 1);
+	threadRoots[thread].push_back({ uint32_t(b), uint32_t(entries[0]) });
+	std::vector<uint64_t>().swap(entries);
+}
+
+// A spill file is a sequence of (node count, nodes, root count, roots) segments.
+void DAGBuilder::spill(unsigned thread) {
+	auto& stream = spillStreams[thread];
+	if (spillFiles[thread].empty()) {
+		const auto directory = options.spillDirectory.empty() ? std::filesystem::temp_directory_path() : std::filesystem::path(options.spillDirectory);
+		spillFiles[thread] = (directory / ("svdag-" + std::to_string(std::random_device{}()) + "-" + std::to_string(thread) + ".spill")).string();
+		stream.open(spillFiles[thread], std::ios::binary);
+	}
+	if (!stream) {
+		// keep the nodes in memory instead
+		return;
+	}
+	const auto& nodes = tables[thread].getNodes();
+	auto& bucketRoots = threadRoots[thread];
+	const uint64_t nodeCount = nodes.size(), rootCount = bucketRoots.size();
+	stream.write(reinterpret_cast<const char*>(&nodeCount), sizeof(nodeCount));
+	stream.write(reinterpret_cast<const char*>(nodes.data()), nodeCount * sizeof(DAGNode));
+	stream.write(reinterpret_cast<const char*>(&rootCount), sizeof(rootCount));
+	stream.write(reinterpret_cast<const char*>(bucketRoots.data()), rootCount * sizeof(bucketRoots[0]));
+	tables[thread].clear();
+	bucketRoots.clear();
+}
+
+void DAGBuilder::merge(const std::vector<DAGNode>& nodes, const std::vector<std::pair<uint32_t, uint32_t>>& cubeRoots) {
+	// children are interned before their parents
+	std::vector<uint32_t> toMerged;
+	toMerged.reserve(nodes.size());
+	for (auto node : nodes) {
+		for (int i = 0; i < std::popcount(node.bitmask); i++) {
+			const auto child = node.children[i];
+			node.children[i] = toMerged[child & DAGNode::IdMask] ^ (child & ~DAGNode::IdMask);
+		}
+		toMerged.push_back(intern(table, node));
+	}
+	for (auto [cube, root] : cubeRoots) roots.push_back(uint64_t(cube) << 32 | (toMerged[root & DAGNode::IdMask] ^ (root & ~DAGNode::IdMask)));
+}
+
+void DAGBuilder::nextFrame() {
+	if (options.format.geometryOnly) {
+		std::cerr << "The attribute runs of a geometry only SVDAG are of a single frame, storing materials in the nodes" << std::endl;
+		options.format.geometryOnly = false;
+	}
+	frameRoots.push_back(reduceFrame());
+	// the next frame starts from no voxels, but keeps the materials, models and nodes
+	reducing = false;
+	columnsBuilt = false;
+	placements.clear();
+	for (auto& file : spillFiles) file.clear();
+	spillStreams = std::vector<std::ofstream>(options.threads);
+}
+
+uint32_t DAGBuilder::reduceFrame() {
+	startReducing();
+	parallelFor(buckets.size(), [&](size_t b, unsigned thread) {
+		if (!buckets[b].empty()) reduceBucket(b, thread);
+	});
+
+	// merge the spilled and the per thread tables
+	for (unsigned t = 0; t < options.threads; t++) {
+		if (!spillFiles[t].empty()) {
+			if (!spillStreams[t]) std::cerr << "Could not write " << spillFiles[t] << ", chunks were kept in memory" << std::endl;
+			spillStreams[t].close();
+			std::ifstream stream(spillFiles[t], std::ios::binary);
+			std::vector<DAGNode> nodes;
+			std::vector<std::pair<uint32_t, uint32_t>> bucketRoots;
+			for (uint64_t count; stream.read(reinterpret_cast<char*>(&count), sizeof(count));) {
+				nodes.resize(count);
+				stream.read(reinterpret_cast<char*>(nodes.data()), count * sizeof(DAGNode));
+				stream.read(reinterpret_cast<char*>(&count), sizeof(count));
+				bucketRoots.resize(count);
+				stream.read(reinterpret_cast<char*>(bucketRoots.data()), count * sizeof(bucketRoots[0]));
+				merge(nodes, bucketRoots);
+			}
+			stream.close();
+			std::filesystem::remove(spillFiles[t]);
+		}
+		merge(tables[t].getNodes(), threadRoots[t]);
+		tables[t].clear();
+		threadRoots[t].clear();
+	}
+	// the roots of the buckets or chunks are merged in any order
+	radixSort(roots, 3 * (levels - rootLevels));
+	reduce(roots, levels - rootLevels, table);
+
+	uint32_t root = placeModels(roots.empty() ? UINT32_MAX : uint32_t(roots[0]));
+	roots.clear();
+	if (root == UINT32_MAX) {
+		DAGNode emptyRoot;
+		emptyRoot.material = emptyMaterial;
+		root = table.intern(emptyRoot);
+	}
+	return root;
+}
+
+SVDAG DAGBuilder::build() {
+	frameRoots.push_back(reduceFrame());
+	SVDAG result;
+	result.rootSize = getSize();
+	result.format = options.format;
+	table.write(frameRoots, materials, result);
+	if (options.format.geometryOnly) {
+		result.materials = materials;
+		std::vector<Attributes> cubes;
+		for (auto& thread : threadAttributes) std::move(thread.begin(), thread.end(), std::back_inserter(cubes));
+		threadAttributes.clear();
+		std::sort(cubes.begin(), cubes.end(), [](const Attributes& a, const Attributes& b) { return a.cube < b.cube; });
+		uint64_t start = 0;
+		for (const auto& cube : cubes) {
+			for (auto [first, material] : cube.runs) result.appendAttribute(uint32_t(start + first), material);
+			start += cube.voxels;
+		}
+	}
+	if (options.verify) {
+		// only the voxels of the last frame are kept
+		const uint32_t shown = result.rootIndex;
+		if (!result.frameRoots.empty()) result.rootIndex = result.frameRoots.back();
+		verify(result);
+		result.rootIndex = shown;
+	}
+	// the arrays grew while they were written, and are kept as long as the scene is
+	result.shrinkToFit();
+	return result;
+}
+
+uint32_t DAGBuilder::placeModels(uint32_t root) {
+	// (Morton code of the cube << 32 | node) of the subtrees of every model by level
+	std::map<std::pair<uint32_t, int>, std::vector<uint64_t>> subtrees;
+	for (const auto& placement : placements) {
+		const auto& voxels = models[placement.model];
+		auto& cubes = subtrees[{ placement.model, placement.level }];
+		if (cubes.empty() && !voxels.empty()) {
+			uint32_t extent = 1;
+			for (auto& voxel : voxels) extent = std::max({ extent, voxel.x + 1, voxel.y + 1, voxel.z + 1 });
+			const int modelLevels = std::bit_width(std::bit_ceil(extent)) - 1;
+			assert(modelLevels <= 10); // sort keys are 32 bits
+			cubes.reserve(voxels.size());
+			for (auto& voxel : voxels) cubes.push_back(morton(voxel.x, voxel.y, voxel.z) << 32 | table.leaf(voxel.material));
+			radixSort(cubes, 3 * modelLevels);
+			reduce(cubes, placement.level, table);
+		}
+		const uint32_t x = placement.x >> placement.level, y = placement.y >> placement.level, z = placement.z >> placement.level;
+		for (auto cube : cubes) {
+			const uint64_t code = keyOf(cube);
+			root = graft(root, levels, morton(x + compactBits(code >> 2), y + compactBits(code >> 1), z + compactBits(code)), placement.level, uint32_t(cube));
+		}
+		if (options.verify) {
+			for (auto& voxel : voxels) verifyVoxels[0].push_back({ morton(placement.x + voxel.x, placement.y + voxel.y, placement.z + voxel.z), voxel.material });
+		}
+	}
+	return root;
+}
+
+uint32_t DAGBuilder::graft(uint32_t ref, int level, uint64_t code, int nodeLevel, uint32_t node) {
+	if (level == nodeLevel) {
+		assert(ref == UINT32_MAX); // placed models can't overlap other voxels
+		return node;
+	}
+	uint32_t children[8];
+	std::fill(children, children + 8, UINT32_MAX);
+	if (ref != UINT32_MAX) {
+		const DAGNode parent = table.resolve(ref);
+		assert(parent.bitmask); // a filled node overlaps the model
+		for (int i = 0, cnt = 0; i < 8; i++) {
+			if (parent.bitmask >> i & 1) children[i] = parent.children[cnt++];
+		}
+	}
+	const int octant = int(code >> 3 * (level - 1 - nodeLevel) & 7);
+	children[octant] = graft(children[octant], level - 1, code, nodeLevel, node);
+	DAGNode result;
+	result.material = emptyMaterial;
+	int cnt = 0;
+	for (int i = 0; i < 8; i++) {
+		if (children[i] == UINT32_MAX) continue;
+		result.bitmask |= 1 << i;
+		result.children[cnt++] = children[i];
+	}
+	return intern(table, result);
+}
+
+// compares every filled voxel of `result` with the voxels that were set, in Morton order
+bool DAGBuilder::verify(const SVDAG& result) {
+	auto& expected = verifyVoxels[0];
+	for (size_t t = 1; t < verifyVoxels.size(); t++) {
+		expected.insert(expected.end(), verifyVoxels[t].begin(), verifyVoxels[t].end());
+		std::vector<std::pair<uint64_t, uint32_t>>().swap(verifyVoxels[t]);
+	}
+	std::sort(expected.begin(), expected.end());
+	size_t next = 0;
+	bool ok = true;
+	result.forEachVoxel([&](uint32_t x, uint32_t y, uint32_t z, const SVO::Material& material) {
+		if (!ok) return;
+		if (next == expected.size() || expected[next].first != morton(x, y, z)) {
+			std::cerr << "SVDAG verification failed: unexpected voxel at ("
+				<< x << ", " << y << ", " << z << ")" << std::endl;
+			ok = false;
+		}
+		else if (!(materials[expected[next].second] == material)) {
+			std::cerr << "SVDAG verification failed: wrong material at ("
+				<< x << ", " << y << ", " << z << ")" << std::endl;
+			ok = false;
+		}
+		next++;
+	});
+	if (ok && next != expected.size()) {
+		std::cerr << "SVDAG verification failed: voxels are missing" << std::endl;
+		ok = false;
+	}
+	if (ok) std::cout << "SVDAG verified, " << next << " voxels match" << std::endl;
+	return ok;
+}
+
+SVDAG* DAGBuilder::terrain(int size, const Options& options) {
+	constexpr int waterLevel = 32;
+	constexpr glm::uvec3 waterColor = { 35, 137, 218 },
+		grassColor = { 38, 139, 7 },
+		grassColor2 = { 65, 152, 10 },
+		dirtColor = { 155, 118, 83 },
+		sandColor = { 246,215,176 };
+
+	const Noise noise(options.seed);
+	DAGBuilder builder(size, options);
+	const uint32_t water = builder.material({ waterColor, 1 }),
+		grass = builder.material({ grassColor }),
+		grass2 = builder.material({ grassColor2 }),
+		dirt = builder.material({ dirtColor }),
+		sand = builder.material({ sandColor });
+	// dirt, the surface voxel and water. Columns are generated on worker threads, so they only
+	// depend on the seed and the column, never on shared random state like rand().
+	builder.buildColumns(size, 3, [&](int x, int z0, int z1, ColumnSpans* spans) {
+		int heights[Noise::BatchSize];
+		for (int batch = z0; batch < z1; batch += Noise::BatchSize) {
+			const int count = std::min(Noise::BatchSize, z1 - batch);
+			noise.heights(x, batch, count, heights);
+			for (int z = batch; z < batch + count; z++) {
+				const auto height = std::min(heights[z - batch], size);
+				const bool underWater = height < waterLevel;
+				const auto yMax = std::min(size, std::max(waterLevel, height));
+				spans[z - z0] = { { uint32_t(std::max(height - 1, 0)), uint32_t(std::max(height, 0)), uint32_t(yMax) },
+					{ dirt, underWater ? sand : (Noise::random(options.seed, x, z) & 1 ? grass : grass2), water } };
+			}
+		}
+	});
+	return new SVDAG(builder.build());
+}
+
+SVDAG* DAGBuilder::stair(int size, const Options& options) {
+	DAGBuilder builder(size, options);
+	const uint32_t blue = builder.material({ {0,0,255} });
+	builder.buildColumns(size, 1, [&](int x, int z0, int z1, ColumnSpans* spans) {
+		for (int z = z0; z < z1; z++) spans[z - z0] = { { uint32_t(std::min(x + z, size)) }, { blue } };
+	});
+	return new SVDAG(builder.build());
+}
+
+SVDAG* DAGBuilder::fromVox(const char* filename, const Options& options) {
+	return buildVox(filename, options, false);
+}
+
+SVDAG* DAGBuilder::animationFromVox(const char* filename, const Options& options) {
+	return buildVox(filename, options, true);
+}
+
+SVDAG* DAGBuilder::buildVox(const char* filename, const Options& options, bool animation) {
+	VoxFile file(filename);
+	if (!file.valid()) return nullptr;
+	DAGBuilder builder(file.size(), options);
+	uint32_t materials[256];
+	std::fill(std::begin(materials), std::end(materials), UINT32_MAX);
+	auto materialOf = [&](uint32_t color) {
+		auto& material = materials[color];
+		if (material == UINT32_MAX) material = builder.material({ file.color(color) });
+		return material;
+	};
+
+	// Instances of a model with the same rotation are shared if their corner is aligned to cubes
+	// of at least MinSharedLevel and those cubes hold nothing else, otherwise their voxels are set.
+	constexpr int MinSharedLevel = 3;
+	using Key = std::tuple<uint32_t, int, int, int, int, int, int, int, int, int>;
+	auto shareKey = [](const VoxFile::Instance& instance) {
+		const auto& a = instance.axes;
+		return Key{ instance.model, a[0].x, a[0].y, a[0].z, a[1].x, a[1].y, a[1].z, a[2].x, a[2].y, a[2].z };
+	};
+	std::map<Key, uint32_t> sharedModels; // also by the frames after the one that added them
+	const uint32_t frames = animation ? file.frameCount() : 1;
+	for (uint32_t frame = 0; frame < frames; frame++) {
+		if (frame) builder.nextFrame();
+		const auto& instances = file.getInstances(frame);
+		std::map<Key, uint32_t> instanceCounts;
+		for (const auto& instance : instances) instanceCounts[shareKey(instance)]++;
+		auto sharedLevel = [&](size_t i) {
+			const auto& instance = instances[i];
+			if (instanceCounts[shareKey(instance)] < 2) return -1;
+			const uint32_t extent = std::max({ instance.max.x - instance.min.x, instance.max.y - instance.min.y, instance.max.z - instance.min.z });
+			const uint32_t corner = instance.min.x | instance.min.y | instance.min.z;
+			const int level = std::min(int(std::bit_width(std::bit_ceil(extent))) - 1, corner ? std::countr_zero(corner) : 31);
+			if (level < MinSharedLevel) return -1;
+			const uint32_t mask = (1u << level) - 1;
+			for (size_t j = 0; j < instances.size(); j++) {
+				const auto& other = instances[j];
+				if (j != i && other.min.x < ((instance.max.x + mask) & ~mask) && instance.min.x < other.max.x &&
+					other.min.y < ((instance.max.y + mask) & ~mask) && instance.min.y < other.max.y &&
+					other.min.z < ((instance.max.z + mask) & ~mask) && instance.min.z < other.max.z) return -1;
+			}
+			return level;
+		};
+
+		for (size_t i = 0; i < instances.size(); i++) {
+			const auto& instance = instances[i];
+			const int level = sharedLevel(i);
+			if (level < 0) {
+				file.forEachBatch(instance, { 0, 0, 0 }, [&](std::span<const VoxFile::Voxel> batch) {
+					for (auto& voxel : batch) builder.set(voxel.x, voxel.y, voxel.z, materialOf(voxel.color));
+				});
+				continue;
+			}
+			auto [model, inserted] = sharedModels.try_emplace(shareKey(instance));
+			if (inserted) {
+				std::vector<Voxel> modelVoxels;
+				file.forEachBatch(instance, instance.min, [&](std::span<const VoxFile::Voxel> batch) {
+					for (auto& voxel : batch) modelVoxels.push_back({ voxel.x, voxel.y, voxel.z, materialOf(voxel.color) });
+				});
+				model->second = builder.addModel(std::move(modelVoxels));
+			}
+			builder.placeModel(model->second, instance.min.x, instance.min.y, instance.min.z, level);
+		}
+	}
+	return new SVDAG(builder.build());
+}
@@ -0,0 +1,172 @@
+#pragma once
+#include <vector>
+#include <unordered_map>
+#include <functional>
+#include <thread>
+#include <atomic>
+#include <string>
+#include <fstream>
+#include <glm/glm.hpp>
+#include "SVDAG.h"
+#include "NodeTable.h"
+
+struct DAGBuildOptions {
+	unsigned threads = std::thread::hardware_concurrency();
+	// decode the result again and compare it with the voxels that were set
+	bool verify = false;
+	SVDAGFormat format;
+	// With a chunk size (a power of two up to 1024), buildColumns() builds the scene in cubes
+	// of chunkSize instead of cubes of the 10 lowest levels, and spills the nodes of every
+	// chunk to a file in spillDirectory (the temporary directory if empty) as soon as it is
+	// built, so that only the final SVDAG and the chunks being built are in memory. Voxels
+	// that are set() are still kept until build().
+	unsigned chunkSize = 0;
+	std::string spillDirectory;
+	// of generated scenes, the same seed gives the same SVDAG with any number of threads
+	uint32_t seed = 0;
+	// if set, the fraction of the work of the current parallel step that is done, which
+	// another thread can show while the SVDAG is built
+	std::atomic<float>* progress = nullptr;
+};
+
+// Builds an SVDAG directly from voxels without ever creating the pointer octree.
+// Voxels are bucketed by the top levels of their Morton code, every bucket is
+// radix sorted and reduced level by level from the leaves up into deduplicated
+// nodes, and the unique nodes are finally written out in the same layout as
+// SVO::toSVDAG.
+// Buckets are independent of each other, so they are reduced on worker threads
+// with their own node tables which are merged into one at the end. The output
+// does not depend on the number of threads.
+class DAGBuilder {
+public:
+	using Options = DAGBuildOptions;
+	struct Voxel {
+		uint32_t x, y, z;
+		uint32_t material;
+	};
+
+	// The voxels of a column from the bottom up: span i is of materials[i] and goes from the
+	// top of the span below it (or 0) up to below tops[i], so it is empty if both tops are the
+	// same. Tops never decrease, and the column is empty above the last span.
+	struct ColumnSpans {
+		static constexpr int MaxSpans = 4;
+		uint32_t tops[MaxSpans];
+		uint32_t materials[MaxSpans];
+	};
+
+	DAGBuilder(size_t size, const Options& options = {});
+	DAGBuilder(DAGBuilder&) = delete;
+	DAGBuilder(DAGBuilder&&) = delete;
+	DAGBuilder& operator=(DAGBuilder&) = delete;
+	DAGBuilder& operator=(DAGBuilder&&) = delete;
+
+	// returns the id of `material` to be used with set()
+	uint32_t material(const SVO::Material& material);
+	// Can be called from multiple threads as long as they are writing to
+	// different buckets.
+	void set(uint32_t x, uint32_t y, uint32_t z, uint32_t material);
+	void set(uint32_t x, uint32_t y, uint32_t z, glm::uvec3 rgb, bool water = false) {
+		set(x, y, z, material({ rgb, water }));
+	}
+	// Returns the id of a model of `voxels` relative to its corner, which can be placed any
+	// number of times but is only reduced to nodes once for every level it is placed at.
+	uint32_t addModel(std::vector<Voxel> voxels);
+	// Places model `id` at x, y, z, which are multiples of 2^level. The model is linked into the
+	// tree as subtrees of 2^level by build(), so the cubes of 2^level that it covers there must
+	// hold no other voxels. With format.geometryOnly its voxels are set one by one instead.
+	void placeModel(uint32_t id, uint32_t x, uint32_t y, uint32_t z, int level);
+	// Ends the frame of an animation with the voxels set and the models placed so far, and
+	// starts the next one without any. build() ends the last frame and writes every frame
+	// into one SVDAG whose nodes they share, see SVDAG::frameRoots. Animations are never
+	// format.geometryOnly.
+	void nextFrame();
+	SVDAG build();
+
+	// Builds every chunk straight from the spans of its columns, which `columns(x, z0, z1, spans)`
+	// sets for the columns x, [z0, z1) with `spanCount` spans each. A cube that is inside the same
+	// span of all of its columns becomes a filled subtree without visiting its voxels, so the work
+	// grows with the surface instead of the volume. Runs on all threads, and no voxels can be set
+	// afterwards.
+	void buildColumns(int size, int spanCount, const std::function<void(int x, int z0, int z1, ColumnSpans* spans)>& columns);
+
+	size_t getSize() const noexcept { return size_t(1) << levels; }
+
+	static SVDAG* terrain(int size, const Options& options = {});
+	static SVDAG* stair(int size, const Options& options = {});
+	static SVDAG* fromVox(const char* filename, const Options& options = {}); // null if it can't be read
+	// every frame of an animated .vox file, see nextFrame()
+	static SVDAG* animationFromVox(const char* filename, const Options& options = {});
+
+private:
+	// runs `task(i, thread)` for every 0 <= i < count on the worker threads
+	void parallelFor(size_t count, const std::function<void(size_t i, unsigned thread)>& task);
+	// the first frame of a .vox file, or all of them for an `animation`
+	static SVDAG* buildVox(const char* filename, const Options& options, bool animation);
+	// reduces the voxels and models of the frame into `table` and returns its root
+	uint32_t reduceFrame();
+	void reduce(std::vector<uint64_t>& entries, int levels, NodeTable& table);
+	// sizes the per thread and per bucket state, after which no materials can be added
+	void startReducing();
+	// reduces the voxels of a bucket to nodes in the table of `thread`
+	void reduceBucket(size_t bucket, unsigned thread);
+	// appends the table of `thread` and the roots in it to its spill file and clears them
+	void spill(unsigned thread);
+	// interns the nodes of a thread table into `table` and adds the roots of their buckets or chunks
+	void merge(const std::vector<DAGNode>& nodes, const std::vector<std::pair<uint32_t, uint32_t>>& cubeRoots);
+	// returns a reference to `node` in `table`, see SVDAGFormat::symmetry
+	uint32_t intern(NodeTable& table, const DAGNode& node) const;
+	// the spans of the columns of the tile that is built by buildColumns()
+	struct ColumnTile;
+	// Returns the node of the cube of 2^level at y and column x, z in squares of 2^level columns,
+	// or UINT32_MAX if it is empty. `code` is the Morton code of its first voxel within the chunk.
+	uint32_t columnNode(ColumnTile& tile, int level, uint32_t x, uint32_t y, uint32_t z, uint32_t code);
+	// returns the node of a cube of 2^level filled with `material`, and adds its voxels to the chunk
+	uint32_t filledNode(ColumnTile& tile, uint32_t material, int level, uint32_t code);
+	// links the placed models into the tree of `root` (UINT32_MAX if empty) and returns its new root
+	uint32_t placeModels(uint32_t root);
+	// Returns `ref`, a node of 2^level or UINT32_MAX if empty, with `node` as its descendant of
+	// 2^nodeLevel at Morton code `code` (in cubes of 2^nodeLevel), where there was nothing.
+	uint32_t graft(uint32_t ref, int level, uint64_t code, int nodeLevel, uint32_t node);
+	bool verify(const SVDAG& result);
+
+	Options options;
+	int levels = 0;        // log2 of the root size
+	int bucketLevels = 0;  // levels resolved by the bucket index rather than the sort key
+	int chunkLevels = 0;   // log2 of the size of the chunks built by buildColumns()
+	// voxels as (Morton code within the bucket << 32 | material id), one list per bucket
+	std::vector<std::vector<uint64_t>> buckets;
+
+	std::vector<SVO::Material> materials;
+	std::unordered_map<SVO::Material, uint32_t, SVO::MaterialHasher> materialToId;
+	uint32_t emptyMaterial = 0;
+
+	NodeTable table; // the merged table, also used for the levels above the buckets
+
+	// State of the frame that is reduced, see startReducing(). It is only kept for the buckets
+	// or chunks that hold voxels, as there can be far more chunks than buckets.
+	bool reducing = false;
+	bool columnsBuilt = false; // by buildColumns(), then the voxels that were set are ignored
+	int rootLevels = 0;        // log2 of the size of the buckets or chunks that the roots are of
+	std::vector<NodeTable> tables; // one per thread
+	std::vector<std::vector<std::pair<uint32_t, uint32_t>>> threadRoots; // (bucket or chunk, root in the thread table)
+	std::vector<std::string> spillFiles; // per thread, empty until the first spill
+	std::vector<std::ofstream> spillStreams;
+	std::vector<uint64_t> roots; // (bucket or chunk << 32 | root in `table`) once merged
+	// (Morton code, material id) of the voxels set on every thread, for Options::verify
+	std::vector<std::vector<std::pair<uint64_t, uint32_t>>> verifyVoxels;
+	struct Attributes {
+		uint32_t cube; // bucket or chunk
+		uint32_t voxels;
+		std::vector<std::pair<uint32_t, uint32_t>> runs; // (index of the first voxel within the cube, material)
+	};
+	std::vector<std::vector<Attributes>> threadAttributes; // per thread, with format.geometryOnly
+
+	struct Placement {
+		uint32_t model;
+		uint32_t x, y, z;
+		int level;
+	};
+	std::vector<std::vector<Voxel>> models;
+	std::vector<Placement> placements;
+	std::vector<uint32_t> frameRoots; // of the frames ended by nextFrame()
+};
@@ -0,0 +1,64 @@
+#include "DAGCache.h"
+#include "MappedFile.h"
+#include "SVDAGFile.h"
+#include <chrono>
+#include <cstring>
+#include <filesystem>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+
+// finalizer of MurmurHash3, every input bit affects every output bit
+static uint64_t mix(uint64_t h) {
+	h ^= h >> 33;
+	h *= 0xff51afd7ed558ccdull;
+	h ^= h >> 33;
+	h *= 0xc4ceb9fe1a85ec53ull;
+	h ^= h >> 33;
+	return h;
+}
+
+// not cryptographic, but any change of the bytes changes the hash
+static uint64_t hashBytes(const char* data, size_t size, uint64_t h) {
+	h = mix(h ^ size);
+	for (size_t i = 0; i < size; i += 8) {
+		uint64_t word = 0;
+		std::memcpy(&word, data + i, std::min<size_t>(8, size - i));
+		h = mix(h ^ (word + 0x9E3779B97F4A7C15ull));
+	}
+	return h;
+}
+
+SVDAG* DAGCache::load(const char* filename, const SVDAGFormat& format, const std::function<SVDAG*()>& build, Stats& stats, bool animation) {
+	const auto start = std::chrono::steady_clock::now();
+	uint64_t key;
+	{
+		MappedFile file(filename);
+		if (!file.data()) {
+			std::cerr << "Failed to read " << filename << std::endl;
+			return nullptr;
+		}
+		const uint64_t options = uint64_t(BuilderVersion) << 32 | format.leafBricks | format.geometryOnly << 1 |
+			format.symmetry << 2 | format.relativePointers << 3 | animation << 4;
+		key = hashBytes(file.data(), file.size(), mix(options));
+	}
+	std::stringstream path;
+	path << Directory << "/" << std::hex << std::setw(16) << std::setfill('0') << key << ".svdag";
+
+	SVDAG* result = nullptr;
+	if (std::filesystem::exists(path.str())) {
+		// copied so that the scene can still be edited
+		SVDAGFile cached(path.str().c_str());
+		if (cached.valid()) result = new SVDAG(cached.toSVDAG());
+	}
+	stats.hit = result != nullptr;
+	if (!result) {
+		result = build();
+		if (!result) return nullptr;
+		std::filesystem::create_directories(Directory);
+		SVDAGFile::save(*result, path.str().c_str());
+	}
+	stats.milliseconds = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+	std::cout << filename << (stats.hit ? ": cache hit, " : ": cache miss, ") << stats.milliseconds << " ms" << std::endl;
+	return result;
+}
@@ -0,0 +1,22 @@
+#pragma once
+#include <functional>
+#include "DAGBuilder.h"
+
+// Caches SVDAGs built from a file in Directory as .svdag files (see SVDAGFile). The key is a
+// hash of the bytes of the file, BuilderVersion and the format, so a changed file or format
+// builds the SVDAG again.
+namespace DAGCache {
+	constexpr const char* Directory = "cache";
+	// bump whenever the SVDAG built from the same file changes
+	constexpr uint32_t BuilderVersion = 6;
+
+	struct Stats {
+		bool hit = false;
+		double milliseconds = 0; // for hashing and loading or building
+	};
+
+	// Returns the cached SVDAG of `filename`, or calls `build` and caches its result. An
+	// `animation` of all frames is cached apart from the same file built as a single frame.
+	// Returns null if the file can't be read.
+	SVDAG* load(const char* filename, const SVDAGFormat& format, const std::function<SVDAG*()>& build, Stats& stats, bool animation = false);
+}
@@ -0,0 +1,52 @@
+#include "MappedFile.h"
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#ifdef _WIN32
+MappedFile::MappedFile(const char* filename) {
+	HANDLE file = CreateFileA(filename, GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+	if (file == INVALID_HANDLE_VALUE) return;
+	LARGE_INTEGER size;
+	if (GetFileSizeEx(file, &size) && size.QuadPart > 0) {
+		// the mapping keeps the file open
+		mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+		if (mapping) {
+			begin = static_cast<const char*>(MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0));
+			if (begin) length = size_t(size.QuadPart);
+		}
+	}
+	CloseHandle(file);
+}
+
+MappedFile::~MappedFile() {
+	if (begin) UnmapViewOfFile(begin);
+	if (mapping) CloseHandle(mapping);
+}
+#else
+MappedFile::MappedFile(const char* filename) {
+	const int file = open(filename, O_RDONLY);
+	if (file == -1) return;
+	struct stat status;
+	if (fstat(file, &status) == 0 && status.st_size > 0) {
+		void* mapped = mmap(nullptr, size_t(status.st_size), PROT_READ, MAP_PRIVATE, file, 0);
+		if (mapped != MAP_FAILED) {
+			madvise(mapped, size_t(status.st_size), MADV_SEQUENTIAL);
+			begin = static_cast<const char*>(mapped);
+			length = size_t(status.st_size);
+		}
+	}
+	close(file);
+}
+
+MappedFile::~MappedFile() {
+	if (begin) munmap(const_cast<char*>(begin), length);
+}
+#endif
@@ -0,0 +1,24 @@
+#pragma once
+#include <cstddef>
+
+// A read-only memory mapping of a whole file.
+class MappedFile {
+public:
+	explicit MappedFile(const char* filename);
+	MappedFile(MappedFile&) = delete;
+	MappedFile(MappedFile&&) = delete;
+	~MappedFile();
+	MappedFile& operator=(MappedFile&) = delete;
+	MappedFile& operator=(MappedFile&&) = delete;
+
+	// null if the file couldn't be mapped or is empty
+	const char* data() const noexcept { return begin; }
+	size_t size() const noexcept { return length; }
+
+private:
+	const char* begin = nullptr;
+	size_t length = 0;
+#ifdef _WIN32
+	void* mapping = nullptr; // HANDLE
+#endif
+};
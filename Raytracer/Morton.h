@@ -0,0 +1,29 @@
+#pragma once
+#include <cstdint>
+
+// spreads the lower 21 bits of `v` so that there are two zero bits between each of them
+inline uint64_t spreadBits(uint64_t v) {
+	v &= 0x1fffff;
+	v = (v | v << 32) & 0x1f00000000ffffull;
+	v = (v | v << 16) & 0x1f0000ff0000ffull;
+	v = (v | v << 8) & 0x100f00f00f00f00full;
+	v = (v | v << 4) & 0x10c30c30c30c30c3ull;
+	v = (v | v << 2) & 0x1249249249249249ull;
+	return v;
+}
+
+// the inverse of spreadBits()
+inline uint32_t compactBits(uint64_t v) {
+	v &= 0x1249249249249249ull;
+	v = (v | v >> 2) & 0x10c30c30c30c30c3ull;
+	v = (v | v >> 4) & 0x100f00f00f00f00full;
+	v = (v | v >> 8) & 0x1f0000ff0000ffull;
+	v = (v | v >> 16) & 0x1f00000000ffffull;
+	v = (v | v >> 32) & 0x1fffff;
+	return uint32_t(v);
+}
+
+// Morton code where every 3 bits are the children index (x*4 + y*2 + z) of one level, root first
+inline uint64_t morton(uint32_t x, uint32_t y, uint32_t z) {
+	return spreadBits(x) << 2 | spreadBits(y) << 1 | spreadBits(z);
+}
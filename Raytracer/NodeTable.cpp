@@ -0,0 +1,306 @@
+#include "NodeTable.h"
+#include <cassert>
+#include <bit>
+#include <algorithm>
+#include <utility>
+#include <cmath>
+
+bool DAGNode::operator==(const DAGNode& other) const noexcept {
+	return material == other.material && bitmask == other.bitmask &&
+		std::equal(children, children + std::popcount(bitmask), other.children);
+}
+
+// finalizer of MurmurHash3, every input bit affects every output bit
+static uint64_t mix(uint64_t h) {
+	h ^= h >> 33;
+	h *= 0xff51afd7ed558ccdull;
+	h ^= h >> 33;
+	h *= 0xc4ceb9fe1a85ec53ull;
+	h ^= h >> 33;
+	return h;
+}
+
+size_t NodeTable::Hasher::operator() (const DAGNode& node) const noexcept {
+	uint64_t h = mix(uint64_t(node.material) << 8 | node.bitmask);
+	for (int i = 0; i < std::popcount(node.bitmask); i++) {
+		h = mix(h ^ (node.children[i] + 0x9E3779B97F4A7C15ull));
+	}
+	return h;
+}
+
+uint32_t NodeTable::intern(const DAGNode& node) {
+	// a node that is filled with one filled node is that node, at any size
+	if (node.bitmask == 255 && !nodes[node.children[0] & DAGNode::IdMask].bitmask &&
+		std::all_of(node.children + 1, node.children + 8, [&](uint32_t child) { return child == node.children[0]; })) {
+		return node.children[0] & DAGNode::IdMask;
+	}
+	if (auto it = nodeToId.find(node); it != nodeToId.end()) return *it;
+	assert(nodes.size() <= DAGNode::IdMask);
+	const auto id = uint32_t(nodes.size());
+	nodes.push_back(node);
+	symmetries.push_back(node.bitmask ? 1 : 255); // a filled node is the same mirrored any way
+	nodeToId.insert(id);
+	return id;
+}
+
+DAGNode NodeTable::mirrored(const DAGNode& node, uint32_t mirror) const noexcept {
+	uint32_t ofOctant[8];
+	for (int i = 0, cnt = 0; i < 8; i++) {
+		if (node.bitmask >> i & 1) ofOctant[i] = node.children[cnt++];
+	}
+	DAGNode result;
+	result.material = node.material;
+	for (uint32_t i = 0, cnt = 0; i < 8; i++) {
+		if (!(node.bitmask >> (i ^ mirror) & 1)) continue;
+		result.bitmask |= 1 << i;
+		// mirroring a node mirrors all of its children the same way
+		result.children[cnt++] = normalized(ofOctant[i ^ mirror] ^ mirror << DAGNode::MirrorShift);
+	}
+	return result;
+}
+
+uint32_t NodeTable::normalized(uint32_t ref) const noexcept {
+	const uint32_t id = ref & DAGNode::IdMask, mirror = ref >> DAGNode::MirrorShift;
+	uint32_t lowest = mirror;
+	for (uint32_t i = 1; i < 8; i++) {
+		if (symmetries[id] >> i & 1) lowest = std::min(lowest, mirror ^ i);
+	}
+	return id | lowest << DAGNode::MirrorShift;
+}
+
+uint32_t NodeTable::internSymmetric(DAGNode node) {
+	if (!node.bitmask) return intern(node);
+	for (int i = 0; i < std::popcount(node.bitmask); i++) node.children[i] = normalized(node.children[i]);
+	DAGNode variants[8];
+	uint32_t best = 0;
+	for (uint32_t mirror = 0; mirror < 8; mirror++) {
+		variants[mirror] = mirror ? mirrored(node, mirror) : node;
+		const auto& a = variants[mirror], & b = variants[best];
+		const int count = std::popcount(a.bitmask);
+		if (a.bitmask < b.bitmask || (a.bitmask == b.bitmask &&
+			std::lexicographical_compare(a.children, a.children + count, b.children, b.children + count))) {
+			best = mirror;
+		}
+	}
+	const size_t count = nodes.size();
+	const auto id = intern(variants[best]);
+	if (nodes.size() != count) {
+		uint8_t group = 0;
+		for (uint32_t mirror = 0; mirror < 8; mirror++) {
+			if (variants[mirror] == variants[best]) group |= 1 << (mirror ^ best);
+		}
+		symmetries[id] = group;
+	}
+	// `best` is the lowest mirror that gives the interned node, so this is normalized
+	return id | best << DAGNode::MirrorShift;
+}
+
+uint32_t NodeTable::leaf(uint32_t material) {
+	if (leafOfMaterial.size() <= material) leafOfMaterial.resize(material + 1, UINT32_MAX);
+	if (leafOfMaterial[material] == UINT32_MAX) {
+		DAGNode node;
+		node.material = material;
+		leafOfMaterial[material] = intern(node);
+	}
+	return leafOfMaterial[material];
+}
+
+DAGNode NodeTable::resolve(uint32_t ref) const {
+	const uint32_t id = ref & DAGNode::IdMask, mirror = ref >> DAGNode::MirrorShift;
+	return mirror ? mirrored(nodes[id], mirror) : nodes[id];
+}
+
+void NodeTable::clear() {
+	decltype(nodeToId)(64, Hasher{ &nodes }, Equal{ &nodes }).swap(nodeToId);
+	std::vector<DAGNode>().swap(nodes);
+	std::vector<uint8_t>().swap(symmetries);
+	std::vector<uint32_t>().swap(leafOfMaterial);
+}
+
+void NodeTable::write(std::span<const uint32_t> roots, const std::vector<SVO::Material>& materials, SVDAG& result) const {
+	if (!result.format.geometryOnly && materials.size() > 1 << 16) result.format.leafBricks = false;
+	// nodes are written with absolute indices first and laid out again afterwards
+	const bool relativePointers = std::exchange(result.format.relativePointers, false);
+	WriteState state{ materials, result, std::vector<int32_t>(nodes.size(), -1), std::vector<int32_t>(materials.size(), -1),
+		std::vector<uint32_t>(nodes.size()), relativePointers };
+	if (result.format.geometryOnly) {
+		state.voxelCounts.resize(nodes.size());
+		for (auto root : roots) {
+			[[maybe_unused]] const auto total = voxelCount(root, uint32_t(result.rootSize), state);
+			assert(total <= UINT32_MAX); // traversal indices are 32 bits on the GPU
+		}
+	}
+	else {
+		state.lods.resize(nodes.size(), { -1, 0, 0, 0 });
+		if (result.lodColors.empty()) result.lodColors.push_back(0);
+	}
+	// later roots reuse the nodes written for the earlier ones
+	for (auto root : roots) {
+		auto position = int32_t(result.nodes.size());
+		if (root >> DAGNode::MirrorShift) write(root, uint32_t(result.rootSize), state);
+		else position = positionOf(root, uint32_t(result.rootSize), state);
+		if (roots.size() > 1) result.frameRoots.push_back(uint32_t(position));
+	}
+	if (!result.frameRoots.empty()) result.rootIndex = result.frameRoots[0];
+	if (relativePointers) result.makePointersRelative();
+}
+
+int32_t NodeTable::materialIndexOf(uint32_t material, WriteState& state) {
+	if (state.materialIndex[material] == -1) {
+		state.materialIndex[material] = state.result.materials.size();
+		state.result.materials.push_back(state.materials[material]);
+	}
+	return state.materialIndex[material];
+}
+
+const std::array<float, 5>& NodeTable::lodOf(uint32_t id, WriteState& state) const {
+	auto& lod = state.lods[id];
+	if (lod[0] >= 0) return lod;
+	const DAGNode& node = nodes[id];
+	if (!node.bitmask) {
+		const auto color = state.materials[node.material].color();
+		lod = { 1, float(color.r), float(color.g), float(color.b), state.materials[node.material].water() ? 1.f : 0.f };
+		return lod;
+	}
+	std::array<float, 5> sum = { 0, 0, 0, 0, 0 };
+	for (int i = 0; i < std::popcount(node.bitmask); i++) {
+		// mirroring doesn't change the average
+		const auto& child = lodOf(node.children[i] & DAGNode::IdMask, state);
+		sum[0] += child[0];
+		for (int c = 1; c < 5; c++) sum[c] += child[0] * child[c];
+	}
+	lod = { sum[0] / 8, sum[1] / sum[0], sum[2] / sum[0], sum[3] / sum[0], sum[4] / sum[0] };
+	return lod;
+}
+
+int32_t NodeTable::lodIndexOf(uint32_t id, WriteState& state) const {
+	const auto& lod = lodOf(id, state);
+	auto byte = [](float value) { return uint32_t(std::clamp(std::lround(value), 0l, 255l)); };
+	// a node that isn't empty is never skipped entirely
+	const uint32_t coverage = std::max(byte(lod[0] * 127), 1u);
+	const uint32_t color = coverage << 25 | (lod[4] > 0 ? SVO::Material::Water : 0) | byte(lod[3]) << 16 | byte(lod[2]) << 8 | byte(lod[1]);
+	auto& colors = state.result.lodColors;
+	if (colors.size() >= 1 << 23 && !state.lodIndex.contains(color)) return 0; // out of header bits
+	auto [it, inserted] = state.lodIndex.try_emplace(color, int32_t(colors.size()));
+	if (inserted) colors.push_back(color);
+	return it->second;
+}
+
+uint64_t NodeTable::voxelCount(uint32_t ref, uint32_t size, WriteState& state) const {
+	// a node is almost always at the same level, but a filled one may be used at any
+	const uint32_t id = ref & DAGNode::IdMask;
+	auto& [countedSize, count] = state.voxelCounts[id];
+	if (countedSize == size) return count;
+	const DAGNode& node = nodes[id];
+	uint64_t sum = node.bitmask ? 0 : uint64_t(size) * size * size;
+	for (int i = 0; i < std::popcount(node.bitmask); i++) sum += voxelCount(node.children[i], size / 2, state);
+	state.voxelCounts[id] = { size, sum };
+	return sum;
+}
+
+void NodeTable::write(uint32_t ref, uint32_t size, WriteState& state) const {
+	auto& result = state.result;
+	if (result.format.leafBricks && size == SVDAG::BrickSize && writeBrick(ref, state)) return;
+	// only the root can be mirrored here, there is no child index to store it in
+	const uint32_t id = ref & DAGNode::IdMask, mirror = ref >> DAGNode::MirrorShift;
+	const DAGNode node = mirror ? mirrored(nodes[id], mirror) : nodes[id];
+	const int count = std::popcount(node.bitmask);
+	const size_t bitmaskIndex = result.nodes.size();
+	if (result.format.geometryOnly) {
+		result.nodes.push_back(node.bitmask);
+		result.nodes.resize(result.nodes.size() + count, -1); // placeholder for children index
+		// number of voxels before every child but the first
+		uint64_t before = 0;
+		for (int i = 0; i + 1 < count; i++) {
+			before += voxelCount(node.children[i], size / 2, state);
+			result.nodes.push_back(int32_t(uint32_t(before)));
+		}
+	}
+	else {
+		auto matID = node.bitmask ? lodIndexOf(id, state) : materialIndexOf(node.material, state);
+		assert(matID < 1 << 23); // the highest bit is SVDAG::BrickFlag
+		result.nodes.push_back(node.bitmask | (matID << 8));
+		result.nodes.resize(result.nodes.size() + count, -1); // placeholder for children index
+	}
+	result.nodeCount++;
+
+	for (int i = 0; i < count; i++) {
+		const auto position = positionOf(node.children[i] & DAGNode::IdMask, size / 2, state);
+		assert(uint32_t(position) <= DAGNode::IdMask);
+		// the mirror of the child stays in the highest bits of its index
+		result.nodes[bitmaskIndex + 1 + i] = int32_t(position | (node.children[i] & ~DAGNode::IdMask));
+	}
+}
+
+int32_t NodeTable::positionOf(uint32_t id, uint32_t size, WriteState& state) const {
+	const auto position = int32_t(state.result.nodes.size());
+	if (state.positions[id] == -1) {
+		state.positions[id] = position;
+		state.sizes[id] = size;
+		write(id, size, state);
+		return position;
+	}
+	const auto& format = state.result.format;
+	if (state.sizes[id] == size || !nodes[id].bitmask || (!format.leafBricks && !format.geometryOnly)) return state.positions[id];
+	auto [it, inserted] = state.resizedPositions.try_emplace(uint64_t(id) << 32 | size, position);
+	if (!inserted) return it->second;
+	write(id, size, state);
+	return position;
+}
+
+bool NodeTable::writeBrick(uint32_t ref, WriteState& state) const {
+	uint32_t brick[64];
+	std::fill(brick, brick + 64, UINT32_MAX);
+	fillBrick(ref, 0, SVDAG::BrickSize, brick);
+
+	auto& result = state.result;
+	const bool geometryOnly = result.format.geometryOnly;
+	uint64_t occupancy = 0;
+	std::vector<uint32_t> voxels;
+	for (int i = 0; i < 64; i++) {
+		if (brick[i] == UINT32_MAX) continue;
+		occupancy |= uint64_t(1) << i;
+		voxels.push_back(brick[i]);
+	}
+	if (!geometryOnly) {
+		for (auto& m : voxels) m = materialIndexOf(m, state);
+	}
+
+	// words the nodes would take, children that are already written only cost their index
+	// (assuming that relative pointers are near)
+	size_t nodeWords = 0;
+	std::vector<uint32_t> counted;
+	auto count = [&](auto& self, uint32_t node) -> void {
+		counted.push_back(node);
+		const int children = std::popcount(nodes[node].bitmask);
+		nodeWords += 1 + (state.relativePointers ? (children + 1) / 2 : children) + (geometryOnly && children ? children - 1 : 0);
+		for (int i = 0; i < children; i++) {
+			const auto child = nodes[node].children[i] & DAGNode::IdMask;
+			if (state.positions[child] == -1 && std::find(counted.begin(), counted.end(), child) == counted.end()) self(self, child);
+		}
+	};
+	count(count, ref & DAGNode::IdMask);
+	// Decided by the size with 16 bit ids: the nodes of a subtree that isn't written as a brick
+	// are often shared with others later, so taking more bricks because 8 bit ids make them
+	// smaller grows the SVDAG about as often as it shrinks it.
+	const size_t brickWords = result.brickWords(voxels) == 3 ? 3 : 3 + (voxels.size() + 1) / 2;
+	if (brickWords > nodeWords) return false;
+
+	result.appendBrick(occupancy, voxels);
+	result.nodeCount++;
+	return true;
+}
+
+void NodeTable::fillBrick(uint32_t ref, int first, int size, uint32_t brick[64]) const {
+	const DAGNode& node = nodes[ref & DAGNode::IdMask];
+	if (node.bitmask == 0) {
+		std::fill(brick + first, brick + first + size * size * size, node.material);
+		return;
+	}
+	const uint32_t mirror = ref >> DAGNode::MirrorShift;
+	const int half = size / 2;
+	for (int i = 0, cnt = 0; i < 8; i++) {
+		if (!(node.bitmask >> i & 1)) continue;
+		fillBrick(node.children[cnt++] ^ mirror << DAGNode::MirrorShift, first + (i ^ mirror) * half * half * half, half, brick);
+	}
+}
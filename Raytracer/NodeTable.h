@@ -0,0 +1,115 @@
+#pragma once
+#include <vector>
+#include <unordered_set>
+#include <unordered_map>
+#include <array>
+#include <span>
+#include "SVDAG.h"
+
+// A node of the SVDAG before it is written out. Nodes are deduplicated on
+// the exact tuple (material, bitmask, children), so two different subtrees
+// can never be merged even if their hashes collide.
+struct DAGNode {
+	// A child is referenced by its id in the NodeTable, or by (id | mirror << MirrorShift)
+	// for the child mirrored along x, y and z by bits 2, 1 and 0 of `mirror`. The bits
+	// match those of the children index, so octant i of a mirrored node is octant
+	// i ^ mirror of the node itself.
+	static constexpr int MirrorShift = SVDAG::MirrorShift;
+	static constexpr uint32_t IdMask = (1u << MirrorShift) - 1;
+
+	uint32_t material = 0;
+	uint32_t bitmask = 0;
+	uint32_t children[8] = { 0 }; // only the first popcount(bitmask) are used
+	bool operator==(const DAGNode& other) const noexcept;
+};
+
+// Hash-consing table of unique nodes. A node can only be interned after its
+// children, so ids always increase from the leaves up.
+class NodeTable {
+public:
+	NodeTable() : nodeToId(64, Hasher{ &nodes }, Equal{ &nodes }) {}
+	NodeTable(NodeTable&) = delete;
+	NodeTable(NodeTable&&) = delete;
+	NodeTable& operator=(NodeTable&) = delete;
+	NodeTable& operator=(NodeTable&&) = delete;
+
+	// A node with 8 children that are the same filled node is not stored, its id is that of
+	// the filled node instead, so that uniform subtrees are single nodes at the highest level.
+	uint32_t intern(const DAGNode& node);
+	// Interns whichever of the 8 reflections of `node` sorts first and returns the
+	// reference that mirrors it back to `node`.
+	uint32_t internSymmetric(DAGNode node);
+	uint32_t leaf(uint32_t material);
+	// returns the node that `ref` refers to, mirrored if it is
+	DAGNode resolve(uint32_t ref) const;
+	const std::vector<DAGNode>& getNodes() const noexcept { return nodes; }
+	void clear();
+
+	// Writes `root` of size result.rootSize and every node below it depth-first in the
+	// SVDAG layout given by result.format. `materials` maps the material ids used by the
+	// nodes to materials. With format.geometryOnly the materials of the nodes are ignored
+	// and neither result.materials nor result.attributes are filled, otherwise interior nodes
+	// get the index of their entry in result.lodColors.
+	// Several roots are written one after the other, sharing the nodes below them, and their
+	// positions become result.frameRoots.
+	void write(std::span<const uint32_t> roots, const std::vector<SVO::Material>& materials, SVDAG& result) const;
+	void write(uint32_t root, const std::vector<SVO::Material>& materials, SVDAG& result) const {
+		write({ &root, 1 }, materials, result);
+	}
+
+private:
+	// the set only stores ids, so lookups by DAGNode hash and compare the node itself
+	struct Hasher {
+		using is_transparent = void;
+		const std::vector<DAGNode>* nodes;
+		size_t operator() (const DAGNode& node) const noexcept;
+		size_t operator() (uint32_t id) const noexcept { return (*this)((*nodes)[id]); }
+	};
+	struct Equal {
+		using is_transparent = void;
+		const std::vector<DAGNode>* nodes;
+		const DAGNode& get(const DAGNode& node) const noexcept { return node; }
+		const DAGNode& get(uint32_t id) const noexcept { return (*nodes)[id]; }
+		template <class A, class B>
+		bool operator() (const A& a, const B& b) const noexcept { return get(a) == get(b); }
+	};
+
+	// returns `node` mirrored by `mirror`, with normalized references to the children
+	DAGNode mirrored(const DAGNode& node, uint32_t mirror) const noexcept;
+	// A node that is its own mirror image can be referenced with several mirrors,
+	// returns the reference with the lowest one.
+	uint32_t normalized(uint32_t ref) const noexcept;
+
+	struct WriteState {
+		const std::vector<SVO::Material>& materials;
+		SVDAG& result;
+		std::vector<int32_t> positions, materialIndex; // -1 if not written yet
+		std::vector<uint32_t> sizes; // that the nodes at `positions` were written at
+		bool relativePointers = false; // format.relativePointers, which is only applied after writing
+		std::vector<std::pair<uint32_t, uint64_t>> voxelCounts = {}; // (size, voxels) of every node
+		std::unordered_map<uint64_t, int32_t> resizedPositions = {}; // by (id << 32 | size), see positionOf()
+		std::vector<std::array<float, 5>> lods = {}; // (coverage, red, green, blue, water) of every node, coverage -1 until known
+		std::unordered_map<uint32_t, int32_t> lodIndex = {}; // of every color in result.lodColors
+	};
+	// Returns where node `id` is written at `size`, writing it first if it isn't yet. Collapsed
+	// uniform subtrees make the same node usable at different sizes, which is written again for
+	// every size if there are bricks below it or it stores voxel counts.
+	int32_t positionOf(uint32_t id, uint32_t size, WriteState& state) const;
+	void write(uint32_t ref, uint32_t size, WriteState& state) const;
+	// returns if the brick took fewer words than writing the nodes would have
+	bool writeBrick(uint32_t ref, WriteState& state) const;
+	// sets the material of every voxel of the subtree starting at Morton code `first` of a brick
+	void fillBrick(uint32_t ref, int first, int size, uint32_t brick[64]) const;
+	static int32_t materialIndexOf(uint32_t material, WriteState& state);
+	// Returns the average color and coverage of node `id`. Collapsed subtrees scale every voxel
+	// count of a node by the same factor, so they are the same at any size.
+	const std::array<float, 5>& lodOf(uint32_t id, WriteState& state) const;
+	// returns the index of the color of node `id` in result.lodColors, 0 once there is no room left
+	int32_t lodIndexOf(uint32_t id, WriteState& state) const;
+	uint64_t voxelCount(uint32_t ref, uint32_t size, WriteState& state) const;
+
+	std::vector<DAGNode> nodes;
+	std::vector<uint8_t> symmetries; // bit i is set if the node is the same when mirrored by i
+	std::unordered_set<uint32_t, Hasher, Equal> nodeToId;
+	std::vector<uint32_t> leafOfMaterial;
+};
@@ -3,6 +3,8 @@
 #include "Renderer.h"
 
 #include <cassert>
+#include <chrono>
+#include <climits>
 #include <iostream>
 
 #include "Window.h"
@@ -31,31 +33,185 @@ void error(int i = 0) {
 	}
 }
 
-void Renderer::loadSVO(SVO& svo) {
-	std::cout << "Scene loaded / generated!" << std::endl;
-	std::vector<int32_t> svdag;
-	std::vector<SVO::Material> materials;
-	svo.toSVDAG(svdag, materials);
-	std::cout << "SVDAG size " << svdag.size()
-		<< " with " << materials.size() << " materials" << std::endl;
-	sceneSize = svdag.size();
-	nMaterials = materials.size();
-	rootSize = svo.getSize();
+void Renderer::GrowableBuffer::upload(const void* data, size_t newSize) {
+	if (newSize > capacity) {
+		const size_t grownCapacity = std::max(newSize + newSize / 8, capacity * 2);
+		GLuint grown;
+		glCreateBuffers(1, &grown);
+		glNamedBufferStorage(grown, grownCapacity, nullptr, GL_DYNAMIC_STORAGE_BIT);
+		if (size) glCopyNamedBufferSubData(buffer, grown, 0, 0, size);
+		if (buffer) glDeleteBuffers(1, &buffer);
+		buffer = grown;
+		capacity = grownCapacity;
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, binding, buffer);
+	}
+	if (newSize > size) glNamedBufferSubData(buffer, size, newSize - size, static_cast<const char*>(data) + size);
+	size = newSize;
+}
+
+void Renderer::GrowableBuffer::release() {
+	if (buffer) glDeleteBuffers(1, &buffer);
+	buffer = 0;
+	capacity = size = 0;
+}
 
-	if(svdagBuffer) glDeleteBuffers(1, &svdagBuffer);
-	if(materialsBuffer) glDeleteBuffers(1, &materialsBuffer);
+void Renderer::selectScene(size_t index, int param) {
+	selectedScene = index;
+	// loading the shown scene again may free the SVDAG that is edited
+	if (scenes[index].get() == shownScene) loadedSVDAG = nullptr;
+	loader.load(*scenes[index], param, buildOptions);
+}
+
+void Renderer::showScene(const SceneLoader::Loaded& loaded) {
+	const auto start = std::chrono::steady_clock::now();
+	if (loaded.file) loadSVO(*loaded.file);
+	else if (loaded.svdag && loaded.svdag->rootSize > SVDAG::MaxRootSize) {
+		// SVDAGFile rejects such files already
+		std::cerr << loaded.scene->getDisplayName() << " is larger than the shader can trace (" << SVDAG::MaxRootSize << " voxels a side)" << std::endl;
+		return;
+	}
+	else if (loaded.svdag) loadSVO(*loaded.svdag);
+	else {
+		std::cerr << "Failed to load " << loaded.scene->getDisplayName() << std::endl;
+		return;
+	}
+	glFinish(); // wait for the upload
+	loadMilliseconds = loaded.milliseconds + std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+	cacheStatus = loaded.scene->getCacheStatus();
+	shownScene = loaded.scene;
+	if (loaded.scene->release()) loadedSVDAG = nullptr;
+	// only the shown scene (for edits) and the ones prefetched next to it stay in host memory
+	for (size_t n = 0; n < scenes.size(); n++) {
+		const bool next = n + 1 == selectedScene || n == selectedScene + 1;
+		if (prefetchScenes && next && scenes[n]->keepsLoaded()) loader.prefetch(*scenes[n], buildOptions);
+		else if (scenes[n].get() != shownScene && scenes[n]->hostBytes()) loader.evict(*scenes[n]);
+	}
+}
 
-	glCreateBuffers(1, &svdagBuffer);
-	glNamedBufferStorage(svdagBuffer, svdag.size() * sizeof(int32_t), svdag.data(), 0);
-	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, svdagBuffer);
+void Renderer::loadSVO(SVDAG& svdag) {
+	upload(svdag, svdag.buffers(), svdag.pointerWidths());
+	loadedSVDAG = &svdag;
+	for (auto root : svdag.frameRoots) separateFrameWords += svdag.wordsBelow(root);
+	if (separateFrameWords) {
+		std::cout << svdag.frameRoots.size() << " frames in " << svdag.nodes.size() << " words, "
+			<< separateFrameWords << " as separate SVDAGs" << std::endl;
+	}
+}
 
-	glCreateBuffers(1, &materialsBuffer);
-	glNamedBufferStorage(materialsBuffer, materials.size() * sizeof(SVO::Material), materials.data(), 0);
-	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, materialsBuffer);
+void Renderer::loadSVO(const SVDAGFile& file) {
+	upload(file.info, file.buffers, file.pointerWidths);
+	loadedSVDAG = nullptr;
+}
 
+void Renderer::upload(const SVDAG& svdag, const SVDAGBuffers& buffers, const std::vector<size_t>& widths) {
+	std::cout << "Scene loaded / generated! (" << svdag.nodeCount << " nodes)" << std::endl;
+	std::cout << "SVDAG size " << buffers.nodes.size()
+		<< " with " << buffers.materials.size() << " materials" << std::endl;
+	if (svdag.format.geometryOnly) {
+		std::cout << "Geometry only, " << buffers.attributeStarts.size() << " attribute runs" << std::endl;
+	}
+	std::ostringstream pointers;
+	for (size_t bits = 0; bits < widths.size(); bits++) {
+		if (widths[bits]) pointers << " " << bits << " bits " << widths[bits];
+	}
+	pointerWidths = pointers.str();
+	assert(svdag.rootSize <= SVDAG::MaxRootSize);
+	sceneSize = buffers.nodes.size();
+	nMaterials = buffers.materials.size();
+	rootSize = svdag.rootSize;
+
+	svdagBuffer.release();
+	materialsBuffer.release();
+	if(attributeBuffers[0]) glDeleteBuffers(2, attributeBuffers);
+	if (lodBuffer) glDeleteBuffers(1, &lodBuffer);
+
+	svdagBuffer.upload(buffers.nodes.data(), buffers.nodes.size_bytes());
+	materialsBuffer.upload(buffers.materials.data(), buffers.materials.size_bytes());
+
+	// the materials are padded to whole words, and buffers can't be empty
+	std::vector<uint32_t> starts(buffers.attributeStarts.begin(), buffers.attributeStarts.end()), attributeMaterials((buffers.attributeMaterials.size() + 1) / 2 + 1);
+	starts.resize(std::max<size_t>(starts.size(), 1));
+	std::copy(buffers.attributeMaterials.begin(), buffers.attributeMaterials.end(), reinterpret_cast<uint16_t*>(attributeMaterials.data()));
+	glCreateBuffers(2, attributeBuffers);
+	glNamedBufferStorage(attributeBuffers[0], starts.size() * sizeof(uint32_t), starts.data(), 0);
+	glNamedBufferStorage(attributeBuffers[1], attributeMaterials.size() * sizeof(uint32_t), attributeMaterials.data(), 0);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 4, attributeBuffers[0]);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 5, attributeBuffers[1]);
+	std::vector<uint32_t> lodColors(buffers.lodColors.begin(), buffers.lodColors.end());
+	lodColors.resize(std::max<size_t>(lodColors.size(), 1));
+	glCreateBuffers(1, &lodBuffer);
+	glNamedBufferStorage(lodBuffer, lodColors.size() * sizeof(uint32_t), lodColors.data(), 0);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 6, lodBuffer);
+
+	computeShader->use();
+	computeShader->setInt("RootSize", svdag.rootSize);
+	computeShader->setInt("RootIndex", svdag.rootIndex);
+	computeShader->setBool("GeometryOnly", svdag.format.geometryOnly);
+	computeShader->setInt("NearPointerBits", svdag.format.relativePointers ? svdag.nearBits() : 0);
+	int levelStarts[32];
+	assert(svdag.levelStarts.size() <= 32);
+	std::fill(std::begin(levelStarts), std::end(levelStarts), INT_MAX);
+	std::copy(svdag.levelStarts.begin(), svdag.levelStarts.end(), levelStarts);
+	computeShader->setInts("LevelStarts", levelStarts, 32);
+	currentFrameCount = 0;
+
+	frameRoots = svdag.frameRoots;
+	animationFrame = std::find(frameRoots.begin(), frameRoots.end(), svdag.rootIndex) - frameRoots.begin();
+	frameTime = 0;
+	separateFrameWords = 0;
+}
+
+void Renderer::uploadEdits() {
+	const auto& svdag = *loadedSVDAG;
+	svdagBuffer.upload(svdag.nodes.data(), svdag.nodes.size() * sizeof(int32_t));
+	materialsBuffer.upload(svdag.materials.data(), svdag.materials.size() * sizeof(SVO::Material));
+	sceneSize = svdag.nodes.size();
+	nMaterials = svdag.materials.size();
 	computeShader->use();
-	computeShader->setInt("RootSize", svo.getSize());
+	computeShader->setInt("RootIndex", svdag.rootIndex);
 	currentFrameCount = 0;
+	// the edit only changed the frame that is shown
+	if (!frameRoots.empty()) frameRoots[animationFrame] = loadedSVDAG->frameRoots[animationFrame] = svdag.rootIndex;
+}
+
+void Renderer::showFrame(size_t frame) {
+	animationFrame = frame;
+	frameTime = 0;
+	computeShader->use();
+	computeShader->setInt("RootIndex", frameRoots[frame]);
+	// so that edits apply to the frame that is shown
+	if (loadedSVDAG) loadedSVDAG->rootIndex = frameRoots[frame];
+	currentFrameCount = 0;
+}
+
+void Renderer::editAtLookAt(bool place) {
+	if (!loadedSVDAG) {
+		std::cerr << "The scene can't be edited" << std::endl;
+		return;
+	}
+	// the voxel at the centre of the screen, or the one in front of it for placing
+	const glm::vec3 hit = cameraPos + glm::normalize(cameraFront) * (*autoFocus + (place ? -0.01f : 0.01f));
+	glm::uvec3 min, max;
+	for (int i = 0; i < 3; i++) {
+		const int from = int(std::floor(hit[i])) - brushSize / 2;
+		min[i] = uint32_t(std::clamp(from, 0, int(rootSize)));
+		max[i] = uint32_t(std::clamp(from + brushSize, 0, int(rootSize)));
+	}
+	const bool changed = place ? loadedSVDAG->setBox(min, max, { glm::uvec3(brushColor * 255.f) }) : loadedSVDAG->clearBox(min, max);
+	// unchanged voxels look the same, so keep accumulating
+	if (changed) uploadEdits();
+}
+
+void Renderer::saveScene() {
+	if (!loadedSVDAG) {
+		std::cerr << "The scene is already saved" << std::endl;
+		return;
+	}
+	std::filesystem::create_directories("vox");
+	std::stringstream filename;
+	filename << "vox/scene_" << time(nullptr) << ".svdag";
+	printf("Saving scene to %s\n", filename.str().data());
+	if (SVDAGFile::save(*loadedSVDAG, filename.str().data())) scenes.push_back(std::make_unique<SVDAGFileScene>(filename.str()));
 }
 
 void Renderer::loadScenes() {
@@ -63,14 +219,22 @@ void Renderer::loadScenes() {
 	scenes.push_back(std::make_unique<TestScene>());
 	scenes.push_back(std::make_unique<TerrainScene>());
 	scenes.push_back(std::make_unique<StairScene>());
-	// iter vox files
-	if (std::filesystem::exists("vox")) {
+	// the files in vox/ are added to the list by render() once they are found
+	foundScenes = std::async(std::launch::async, [] {
+		std::vector<std::unique_ptr<Scene>> found;
+		if (!std::filesystem::exists("vox")) return found;
 		for (auto& p : std::filesystem::recursive_directory_iterator("vox")) {
 			if (p.path().extension() == ".vox") {
-				scenes.push_back(std::make_unique<VoxModelScene>(p.path().string()));
+				// animations are kept in vox/anim
+				if (p.path().parent_path().filename() == "anim") found.push_back(std::make_unique<AnimatedVoxScene>(p.path().string()));
+				else found.push_back(std::make_unique<VoxModelScene>(p.path().string()));
+			}
+			else if (p.path().extension() == ".svdag") {
+				found.push_back(std::make_unique<SVDAGFileScene>(p.path().string()));
 			}
 		}
-	}
+		return found;
+	});
 }
 
 void Renderer::init() noexcept {
@@ -118,7 +282,12 @@ void Renderer::init() noexcept {
 	autoFocus = static_cast<float*>(glMapNamedBufferRange(autoFocusBuffer, 0, sizeof(float), GL_MAP_READ_BIT));
 
 	loadScenes();
-	loadSVO(*(scenes[0]->load(0))); // load the first scene
+	// the first scene is small enough to load right away, so that there is always one to show
+	const auto start = std::chrono::steady_clock::now();
+	SceneLoader::Loaded first{ scenes[0].get(), nullptr, nullptr };
+	first.svdag = scenes[0]->load(0, buildOptions);
+	first.milliseconds = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+	showScene(first);
 }
 
 void Renderer::renderUI() noexcept {
@@ -131,6 +300,10 @@ void Renderer::renderUI() noexcept {
 	ImGui::Text("Application average %.3f ms/frame (%.1f FPS)", 1000.0f / io.Framerate, io.Framerate);
 	ImGui::Text("Frames accumulated %d", currentFrameCount);
 	ImGui::Text("Scene size: %d bytes, materials count: %d, root size: %d", sceneSize, nMaterials, rootSize);
+	ImGui::SameLine();
+	if (cacheStatus) ImGui::Text("loaded in %.1f ms (cache %s)", loadMilliseconds, cacheStatus);
+	else ImGui::Text("loaded in %.1f ms", loadMilliseconds);
+	ImGui::Text("Child pointers by width:%s", pointerWidths.c_str());
 	ImGui::Spacing();
 	ImGui::DragFloat3("Camera Position", &cameraPos[0]);
 	ImGui::DragFloat3("Camera front", &cameraFront[0]);
@@ -149,20 +322,33 @@ void Renderer::renderUI() noexcept {
 	}
 	ImGui::Spacing();
 	ImGui::Checkbox("Fast Mode", &fastMode);
+	ImGui::SliderFloat("LOD bias (pixels)", &lodBias, 0.f, 8.f);
 	ImGui::Spacing();
+	if (frameRoots.size() > 1) {
+		ImGui::Checkbox("Play animation", &playAnimation);
+		ImGui::SameLine();
+		ImGui::SliderFloat("FPS", &framesPerSecond, 1.f, 30.f);
+		int frame = int(animationFrame);
+		if (ImGui::SliderInt("Frame", &frame, 0, int(frameRoots.size()) - 1)) showFrame(frame);
+		if (separateFrameWords) {
+			ImGui::Text("%d frames: %d bytes shared, %d bytes as separate SVDAGs", int(frameRoots.size()), int(sceneSize * sizeof(int32_t)), int(separateFrameWords * sizeof(int32_t)));
+		}
+		ImGui::Spacing();
+	}
 
 
-	static int currentSelection = 0;
-	auto& currentScene = scenes[currentSelection];
+	auto& currentScene = scenes[selectedScene];
 	if (ImGui::BeginCombo("Scene", currentScene->getDisplayName(), 0))
 	{
 		for (size_t n = 0; n < scenes.size(); n++)
 		{
-			const bool isSelected = (currentSelection == n);
-			if (ImGui::Selectable(scenes[n]->getDisplayName(), isSelected)) {
-				currentSelection = n;
-			    loadSVO(*(scenes[n]->load(32)));
-				scenes[n]->release();
+			const bool isSelected = (selectedScene == n);
+			// with the host memory the scene keeps, if any
+			std::string label = scenes[n]->getDisplayName();
+			if (const size_t bytes = scenes[n]->hostBytes()) label += " (" + std::to_string(bytes / 1024) + " KiB)";
+			label += "##" + std::to_string(n);
+			if (ImGui::Selectable(label.c_str(), isSelected)) {
+				selectScene(n, 32);
 			}
 			if (isSelected)
 				ImGui::SetItemDefaultFocus();
@@ -175,14 +361,51 @@ void Renderer::renderUI() noexcept {
 		ImGui::InputText(currentScene->getParamName(), paramInput, 64, ImGuiInputTextFlags_CharsDecimal);
 		ImGui::SameLine();
 		if (ImGui::Button("Set")) {
-			loadSVO(*(currentScene->load(std::stoi(paramInput))));
+			selectScene(selectedScene, std::stoi(paramInput));
 		}
 	}
+	// the old scene is shown until the new one is built and uploaded
+	if (Scene* loading = loader.loading()) {
+		ImGui::ProgressBar(loader.progress(), ImVec2(-FLT_MIN, 0), (std::string("Loading ") + loading->getDisplayName()).c_str());
+	}
+	ImGui::Checkbox("Prefetch neighbouring scenes", &prefetchScenes);
+	size_t hostBytes = 0;
+	for (auto& scene : scenes) hostBytes += scene.get() == shownScene && loadedSVDAG ? loadedSVDAG->hostBytes() : scene->hostBytes();
+	ImGui::Text("Host memory: %.1f MiB shown scene, %.1f MiB all scenes (nodes on the GPU: %.1f MiB)",
+		(loadedSVDAG ? loadedSVDAG->hostBytes() : 0) / 1048576.0, hostBytes / 1048576.0, svdagBuffer.size / 1048576.0);
+
+	ImGui::Checkbox("Verify SVDAG when building", &buildOptions.verify);
+	ImGui::SameLine();
+	ImGui::Checkbox("Leaf bricks", &buildOptions.format.leafBricks);
+	ImGui::SameLine();
+	ImGui::Checkbox("Geometry only", &buildOptions.format.geometryOnly);
+	ImGui::SameLine();
+	ImGui::Checkbox("Merge mirrored", &buildOptions.format.symmetry);
+	ImGui::SameLine();
+	ImGui::Checkbox("Relative pointers", &buildOptions.format.relativePointers);
+	ImGui::Spacing();
+	ImGui::InputInt("Brush size", &brushSize);
+	brushSize = std::max(brushSize, 1);
+	ImGui::ColorEdit3("Brush color", &brushColor[0]);
+	if (ImGui::Button("Dig")) editAtLookAt(false);
+	ImGui::SameLine();
+	if (ImGui::Button("Place")) editAtLookAt(true);
+	ImGui::SameLine();
+	ImGui::Text("(at the centre of the screen)");
+
+	int chunkSize = int(buildOptions.chunkSize);
+	if (ImGui::InputInt("Build chunk size (0 for none)", &chunkSize, 0)) buildOptions.chunkSize = unsigned(std::max(chunkSize, 0));
+	int seed = int(buildOptions.seed);
+	if (ImGui::InputInt("Terrain seed", &seed)) buildOptions.seed = uint32_t(seed);
 
 	if (ImGui::Button("Screenshot")) {
 		takeScreenshot();
 	}
 	ImGui::SameLine();
+	if (ImGui::Button("Save scene")) {
+		saveScene();
+	}
+	ImGui::SameLine();
 	if (ImGui::Button("Re-render")) {
 		currentFrameCount = 0;
 	}
@@ -196,6 +419,7 @@ void Renderer::checkForAccumulationFrameInvalidation() noexcept {
 	static float focalLengthLastFrame = focalLength, lenRadiusLastFrame = lenRadius;
 	static glm::vec3 skyColorLastFrame = skyColor, sunColorLastFrame = sunColor, sunDirLastFrame = sunDir;
 	static bool fastModeLastFrame = fastMode;
+	static float lodBiasLastFrame = lodBias;
 	if (cameraPos != cameraPosLastFrame ||
 		cameraFront != cameraFrontLastFrame ||
 		enableDepthOfField != enableDepthOfFieldLastFrame ||
@@ -204,7 +428,8 @@ void Renderer::checkForAccumulationFrameInvalidation() noexcept {
 		skyColor != skyColorLastFrame ||
 		sunColor != sunColorLastFrame ||
 		sunDir != sunDirLastFrame ||
-		fastMode != fastModeLastFrame
+		fastMode != fastModeLastFrame ||
+		lodBias != lodBiasLastFrame
 		)  currentFrameCount = 0;
 	cameraPosLastFrame = cameraPos;
 	cameraFrontLastFrame = cameraFront;
@@ -215,11 +440,20 @@ void Renderer::checkForAccumulationFrameInvalidation() noexcept {
 	sunColorLastFrame = sunColor;
 	sunDirLastFrame = sunDir;
 	fastModeLastFrame = fastMode;
+	lodBiasLastFrame = lodBias;
 }
 
 void Renderer::render() noexcept {
+	if (foundScenes.valid() && foundScenes.wait_for(std::chrono::seconds(0)) == std::future_status::ready) {
+		for (auto& scene : foundScenes.get()) scenes.push_back(std::move(scene));
+	}
+	if (auto loaded = loader.poll()) showScene(*loaded);
 	renderUI();
 	checkForAccumulationFrameInvalidation();
+	if (frameRoots.size() > 1 && playAnimation) {
+		frameTime += ImGui::GetIO().DeltaTime;
+		if (frameTime * framesPerSecond >= 1.f) showFrame((animationFrame + 1) % frameRoots.size());
+	}
 
 	// Raytrace with compute shader
 	computeShader->use();
@@ -235,6 +469,7 @@ void Renderer::render() noexcept {
 	computeShader->setVec3("SunColor", sunColor);
 	computeShader->setVec3("SunDir", sunDir);
 	computeShader->setBool("FastMode", fastMode);
+	computeShader->setFloat("LodBias", lodBias);
 
 	currentFrameCount += 1;
 
@@ -1,10 +1,12 @@
 #pragma once
 #include <optional>
 #include <memory>
+#include <future>
 #include <glm/glm.hpp>
 #include "Shader.h"
 #include "Texture.h"
 #include "Scene.h"
+#include "SceneLoader.h"
 
 class Window;
 
@@ -24,14 +26,39 @@ private:
 	void renderUI() noexcept;
 	void takeScreenshot();
 	void checkForAccumulationFrameInvalidation() noexcept;
-	void loadSVO(SVO& svo);
+	// loads scene `index` on the loader, the current scene is shown until it is ready
+	void selectScene(size_t index, int param);
+	// uploads a scene that the loader is done with
+	void showScene(const SceneLoader::Loaded& loaded);
+	void loadSVO(SVDAG& svdag);
+	// uploads straight from the mapping, the scene can't be edited
+	void loadSVO(const SVDAGFile& file);
+	void upload(const SVDAG& svdag, const SVDAGBuffers& buffers, const std::vector<size_t>& pointerWidths);
+	// uploads what edits appended to the loaded SVDAG
+	void uploadEdits();
+	// starts tracing from the root of `frame` of the animation, without uploading anything
+	void showFrame(size_t frame);
+	void editAtLookAt(bool place);
+	void saveScene();
 	void loadScenes();
 
 	std::optional<Shader> computeShader = std::nullopt, renderShader = std::nullopt;
 	std::optional<Texture> texture = std::nullopt;
 	Window* window;
 	GLuint quadVAO = 0, quadVBO = 0; // for rendering the image (screen quad)
-	GLuint svdagBuffer = 0, materialsBuffer, autoFocusBuffer;
+	// An SSBO with room to grow, so that what edits append to the SVDAG can be uploaded
+	// with glNamedBufferSubData instead of creating the buffer again.
+	struct GrowableBuffer {
+		GLuint binding, buffer = 0;
+		size_t capacity = 0, size = 0; // in bytes
+		// uploads data[size, newSize), moving to a larger buffer first if needed
+		void upload(const void* data, size_t newSize);
+		void release();
+	};
+	GrowableBuffer svdagBuffer{ 1 }, materialsBuffer{ 2 };
+	GLuint autoFocusBuffer;
+	GLuint attributeBuffers[2] = { 0, 0 }; // starts and materials of the attribute runs
+	GLuint lodBuffer = 0; // edits only append nodes without LOD colors
 	glm::vec3 cameraPos = { -2.6f, 0.7f, -0.5f };
 	glm::vec3 cameraUp = { 0.0f, 1.0f, 0.0f };
 	glm::vec3 cameraFront = { 0.7f, -0.2f, 0.7f };
@@ -46,6 +73,15 @@ private:
 	float lenRadius = 0.1f;
 
 	bool fastMode = false;
+	float lodBias = 1.f; // see SVDAG::lodColors
+
+	// animation, see SVDAG::frameRoots
+	std::vector<uint32_t> frameRoots; // moved by edits of their frame
+	size_t animationFrame = 0;
+	bool playAnimation = true;
+	float framesPerSecond = 8.f;
+	float frameTime = 0; // seconds the frame has been shown
+	size_t separateFrameWords = 0; // of the frames as separate SVDAGs, 0 if unknown
 
 	glm::vec3 sunDir { -0.5, 0.75, 0.8 };
 	glm::vec3 sunColor { 1, 1, 1 };
@@ -55,7 +91,20 @@ private:
 
 	// stats
 	size_t sceneSize = 0, nMaterials = 0, rootSize = 0;
+	std::string pointerWidths; // as loaded, see SVDAG::pointerWidths
+	double loadMilliseconds = 0; // building or reading the scene and uploading it
+	const char* cacheStatus = nullptr; // see Scene::getCacheStatus
 
 	// scenes
 	std::vector<std::unique_ptr<Scene>> scenes;
+	std::future<std::vector<std::unique_ptr<Scene>>> foundScenes; // in vox/, appended once found
+	// one thread is left for rendering while scenes are built in the background
+	DAGBuilder::Options buildOptions{ .threads = std::max(std::thread::hardware_concurrency(), 2u) - 1, .chunkSize = 64 };
+	SceneLoader loader;
+	size_t selectedScene = 0;
+	Scene* shownScene = nullptr;
+	bool prefetchScenes = false; // load the scenes next to the selected one in the list ahead
+	SVDAG* loadedSVDAG = nullptr; // for edits, null if the scene freed it
+	int brushSize = 1;
+	glm::vec3 brushColor{ .8, .2, .2 };
 };
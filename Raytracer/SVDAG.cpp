@@ -0,0 +1,477 @@
+#include "SVDAG.h"
+#include <bit>
+#include <cassert>
+#include <numeric>
+#include <algorithm>
+#include <iostream>
+
+namespace {
+	// walks the nodes in Morton order, which is also the order of the attribute runs
+	struct Decoder {
+		const SVDAG& dag;
+		const std::function<void(uint32_t x, uint32_t y, uint32_t z, const SVO::Material& material)>& voxel;
+		uint64_t next = 0; // traversal index of the next voxel
+		size_t run = 0;
+
+		void emit(uint32_t x, uint32_t y, uint32_t z, uint32_t material) {
+			if (dag.format.geometryOnly) {
+				while (run + 1 < dag.attributeStarts.size() && dag.attributeStarts[run + 1] <= next) run++;
+				material = dag.attributeMaterials[run];
+			}
+			next++;
+			voxel(x, y, z, dag.materials[material]);
+		}
+
+		// every voxel of the filled box
+		void fill(uint32_t x, uint32_t y, uint32_t z, uint32_t size, uint32_t material) {
+			if (size == 1) {
+				emit(x, y, z, material);
+				return;
+			}
+			const auto half = size / 2;
+			for (int i = 0; i < 8; i++) {
+				fill(x + (i >> 2 & 1) * half, y + (i >> 1 & 1) * half, z + (i & 1) * half, half, material);
+			}
+		}
+
+		void brick(int32_t index, uint32_t mirror, uint32_t x, uint32_t y, uint32_t z) {
+			const uint64_t occupancy = uint32_t(dag.nodes[index + 1]) | uint64_t(uint32_t(dag.nodes[index + 2])) << 32;
+			for (int bit = 0; bit < 64; bit++) {
+				// the two octree levels of the brick, mirrored like the children index
+				const int stored = bit ^ (mirror << 3 | mirror);
+				if (!(occupancy >> stored & 1)) continue;
+				const int rank = std::popcount(occupancy & ((uint64_t(1) << stored) - 1));
+				emit(x + ((bit >> 4 & 2) | (bit >> 2 & 1)), y + ((bit >> 3 & 2) | (bit >> 1 & 1)), z + ((bit >> 2 & 2) | (bit & 1)),
+					dag.format.geometryOnly ? 0 : dag.brickMaterial(index, rank));
+			}
+		}
+
+		void node(int32_t index, int level, uint32_t mirror, uint32_t x, uint32_t y, uint32_t z, uint32_t size) {
+			const int32_t header = dag.nodes[index];
+			if (header & SVDAG::BrickFlag) {
+				brick(index, mirror, x, y, z);
+				return;
+			}
+			const int bitmask = header & 255;
+			if (bitmask == 0) {
+				fill(x, y, z, size, header >> 8);
+				return;
+			}
+			const auto half = size / 2;
+			for (uint32_t i = 0; i < 8; i++) {
+				const uint32_t stored = i ^ mirror;
+				if (!(bitmask >> stored & 1)) continue;
+				int childLevel = level;
+				const uint32_t child = dag.child(index, std::popcount(uint32_t(bitmask) & ((1u << stored) - 1)), childLevel);
+				node(child & ((1u << SVDAG::MirrorShift) - 1), childLevel, mirror ^ child >> SVDAG::MirrorShift,
+					x + (i >> 2 & 1) * half, y + (i >> 1 & 1) * half, z + (i & 1) * half, half);
+			}
+		}
+	};
+}
+
+namespace {
+	// path copies the nodes that intersect the edited box to the end of the DAG
+	struct Editor {
+		static constexpr uint32_t Empty = UINT32_MAX;
+		static constexpr uint32_t IdMask = (1u << SVDAG::MirrorShift) - 1;
+		SVDAG& dag;
+		glm::uvec3 min, max;
+		int32_t material; // -1 to clear
+
+		bool overlaps(glm::uvec3 origin, uint32_t size) const {
+			for (int i = 0; i < 3; i++) {
+				if (origin[i] >= max[i] || origin[i] + size <= min[i]) return false;
+			}
+			return true;
+		}
+		bool covers(glm::uvec3 origin, uint32_t size) const {
+			for (int i = 0; i < 3; i++) {
+				if (origin[i] < min[i] || origin[i] + size > max[i]) return false;
+			}
+			return true;
+		}
+
+		bool isFilled(uint32_t ref, int32_t material) const {
+			const int32_t header = dag.nodes[ref & IdMask];
+			return header >= 0 && (header & 255) == 0 && header >> 8 == material;
+		}
+
+		uint32_t append(std::initializer_list<int32_t> words) {
+			const auto index = uint32_t(dag.nodes.size());
+			assert(index <= IdMask);
+			dag.nodes.insert(dag.nodes.end(), words);
+			dag.nodeCount++;
+			return index;
+		}
+
+		uint32_t leaf(int32_t material) {
+			if (material < 0) return Empty;
+			return append({ material << 8 });
+		}
+
+		// returns the new reference to the node `ref` (Empty if it's empty) of `size` at `origin`
+		uint32_t edit(uint32_t ref, glm::uvec3 origin, uint32_t size) {
+			if (!overlaps(origin, size)) return ref;
+			if (covers(origin, size)) {
+				if (ref == Empty ? material < 0 : isFilled(ref, material)) return ref;
+				return leaf(material);
+			}
+
+			const uint32_t mirror = ref == Empty ? 0 : ref >> SVDAG::MirrorShift;
+			const int32_t header = ref == Empty ? 0 : dag.nodes[ref & IdMask];
+			if (header < 0) return brick(ref & IdMask, mirror, origin);
+
+			// children by actual octant, a filled node is made of 8 filled children
+			uint32_t children[8];
+			for (uint32_t i = 0; i < 8; i++) {
+				const uint32_t stored = i ^ mirror;
+				if (ref == Empty) children[i] = Empty;
+				else if ((header & 255) == 0) children[i] = ref & IdMask;
+				else if (!(header >> stored & 1)) children[i] = Empty;
+				else {
+					const uint32_t child = uint32_t(dag.nodes[(ref & IdMask) + 1 + std::popcount(uint32_t(header) & ((1u << stored) - 1))]);
+					children[i] = (child & IdMask) | ((child >> SVDAG::MirrorShift) ^ mirror) << SVDAG::MirrorShift;
+				}
+			}
+			bool changed = false;
+			const auto half = size / 2;
+			for (uint32_t i = 0; i < 8; i++) {
+				const auto child = edit(children[i], { origin.x + (i >> 2 & 1) * half, origin.y + (i >> 1 & 1) * half, origin.z + (i & 1) * half }, half);
+				changed |= child != children[i];
+				children[i] = child;
+			}
+			if (!changed) return ref;
+			return node(children);
+		}
+
+		// writes a node with the children by actual octant, or the child if they are all filled the same
+		uint32_t node(const uint32_t children[8]) {
+			if (std::all_of(children, children + 8, [](uint32_t child) { return child == Empty; })) return Empty;
+			if (children[0] != Empty && dag.nodes[children[0] & IdMask] >= 0 && (dag.nodes[children[0] & IdMask] & 255) == 0) {
+				const int32_t filled = dag.nodes[children[0] & IdMask] >> 8;
+				if (std::all_of(children, children + 8, [&](uint32_t child) { return child != Empty && isFilled(child, filled); })) return children[0] & IdMask;
+			}
+			const auto index = append({ 0 });
+			uint32_t bitmask = 0;
+			for (uint32_t i = 0; i < 8; i++) {
+				if (children[i] == Empty) continue;
+				bitmask |= 1 << i;
+				dag.nodes.push_back(int32_t(children[i]));
+			}
+			dag.nodes[index] = int32_t(bitmask);
+			return index;
+		}
+
+		// edits a leaf brick, which is written as nodes if the material doesn't fit into one
+		uint32_t brick(uint32_t index, uint32_t mirror, glm::uvec3 origin) {
+			const uint64_t occupancy = uint32_t(dag.nodes[index + 1]) | uint64_t(uint32_t(dag.nodes[index + 2])) << 32;
+			int32_t voxels[64];
+			for (int bit = 0; bit < 64; bit++) {
+				const int stored = bit ^ (mirror << 3 | mirror);
+				voxels[bit] = -1;
+				if (!(occupancy >> stored & 1)) continue;
+				const int rank = std::popcount(occupancy & ((uint64_t(1) << stored) - 1));
+				voxels[bit] = int32_t(dag.brickMaterial(index, rank));
+			}
+			bool changed = false;
+			for (int bit = 0; bit < 64; bit++) {
+				const glm::uvec3 p = { origin.x + ((bit >> 4 & 2) | (bit >> 2 & 1)), origin.y + ((bit >> 3 & 2) | (bit >> 1 & 1)), origin.z + ((bit >> 2 & 2) | (bit & 1)) };
+				if (covers(p, 1) && voxels[bit] != material) {
+					voxels[bit] = material;
+					changed = true;
+				}
+			}
+			if (!changed) return index | mirror << SVDAG::MirrorShift;
+
+			uint64_t filled = 0;
+			std::vector<uint32_t> materials;
+			for (int bit = 0; bit < 64; bit++) {
+				if (voxels[bit] < 0) continue;
+				filled |= uint64_t(1) << bit;
+				materials.push_back(voxels[bit]);
+			}
+			if (!filled) return Empty;
+			const bool uniform = std::all_of(materials.begin(), materials.end(), [&](uint32_t m) { return m == materials[0]; });
+			if (!uniform && std::any_of(materials.begin(), materials.end(), [](uint32_t m) { return m >= 1 << 16; })) {
+				return nodes(voxels, 0, SVDAG::BrickSize);
+			}
+			assert(dag.nodes.size() <= IdMask);
+			dag.nodeCount++;
+			return dag.appendBrick(filled, materials);
+		}
+
+		// writes the voxels of a brick from Morton code `first` on as nodes
+		uint32_t nodes(const int32_t voxels[64], int first, uint32_t size) {
+			if (size == 1) return leaf(voxels[first]);
+			const uint32_t cube = size * size * size / 8;
+			uint32_t children[8];
+			for (uint32_t i = 0; i < 8; i++) children[i] = nodes(voxels, first + i * cube, size / 2);
+			return node(children);
+		}
+	};
+
+	bool edit(SVDAG& dag, glm::uvec3 min, glm::uvec3 max, int32_t material) {
+		if (dag.format.geometryOnly || dag.format.relativePointers) {
+			std::cerr << "Geometry only SVDAGs and those with relative pointers can't be edited" << std::endl;
+			return false;
+		}
+		Editor editor{ dag, min, max, material };
+		uint32_t root = editor.edit(dag.rootIndex, glm::uvec3(0), uint32_t(dag.rootSize));
+		if (root == dag.rootIndex) return false;
+		if (root == Editor::Empty) {
+			// a filled root has no bitmask, so an empty one has a single empty brick at the bottom
+			root = editor.append({ int32_t(SVDAG::BrickFlag), 0, 0 });
+			for (size_t size = SVDAG::BrickSize * 2; size <= dag.rootSize; size *= 2) root = editor.append({ 1, int32_t(root) });
+		}
+		dag.rootIndex = root & Editor::IdMask;
+		return true;
+	}
+}
+
+bool SVDAG::setBox(glm::uvec3 min, glm::uvec3 max, const SVO::Material& material) {
+	const auto id = int32_t(std::find(materials.begin(), materials.end(), material) - materials.begin());
+	const bool added = size_t(id) == materials.size();
+	if (added) materials.push_back(material);
+	const bool changed = edit(*this, min, max, id);
+	if (added && !changed) materials.pop_back();
+	return changed;
+}
+
+bool SVDAG::clearBox(glm::uvec3 min, glm::uvec3 max) {
+	return edit(*this, min, max, -1);
+}
+
+uint32_t SVDAG::child(size_t index, int slot, int& level) const {
+	if (!format.relativePointers) return uint32_t(nodes[index + 1 + slot]);
+	const uint32_t entry = uint32_t(nodes[index + 1 + slot / 2]) >> (slot % 2 * 16) & 0xffff;
+	if (entry & FarFlag) {
+		const int count = std::popcount(uint32_t(nodes[index]) & 255);
+		const size_t fars = index + 1 + (count + 1) / 2 + (format.geometryOnly ? count - 1 : 0);
+		const uint32_t child = uint32_t(nodes[fars + (entry & ~FarFlag)]);
+		level = levelOf(child & ((1u << MirrorShift) - 1));
+		return child;
+	}
+	const uint32_t offset = entry & ((1u << nearBits()) - 1);
+	level++;
+	return (levelStarts[level] + offset) | (entry >> nearBits()) << MirrorShift;
+}
+
+int SVDAG::levelOf(size_t index) const {
+	return int(std::upper_bound(levelStarts.begin(), levelStarts.end(), index) - levelStarts.begin()) - 1;
+}
+
+size_t SVDAG::nodeWords(size_t index) const {
+	const int32_t header = nodes[index];
+	if (header & BrickFlag) {
+		if (format.geometryOnly || (header & 255) == BrickUniform) return 3;
+		const uint64_t occupancy = uint32_t(nodes[index + 1]) | uint64_t(uint32_t(nodes[index + 2])) << 32;
+		const int perWord = (header & 255) == BrickPerVoxel8 ? 4 : 2;
+		return 3 + (std::popcount(occupancy) + perWord - 1) / perWord;
+	}
+	const int count = std::popcount(uint32_t(header) & 255);
+	const size_t voxelCounts = format.geometryOnly && count ? count - 1 : 0;
+	if (!format.relativePointers) return 1 + count + voxelCounts;
+	size_t fars = 0;
+	for (int slot = 0; slot < count; slot++) {
+		fars += uint32_t(nodes[index + 1 + slot / 2]) >> (slot % 2 * 16) & FarFlag ? 1 : 0;
+	}
+	return 1 + (count + 1) / 2 + voxelCounts + fars;
+}
+
+uint32_t SVDAG::brickMaterial(size_t index, int rank) const {
+	const int32_t header = nodes[index];
+	switch (header & 255) {
+	case BrickPerVoxel: return uint32_t(nodes[index + 3 + rank / 2]) >> (rank % 2 * 16) & 0xffff;
+	case BrickPerVoxel8: return uint32_t(nodes[index + 3 + rank / 4]) >> (rank % 4 * 8) & 0xff;
+	default: return (header & ~BrickFlag) >> 8;
+	}
+}
+
+size_t SVDAG::brickWords(std::span<const uint32_t> materials) const {
+	assert(!materials.empty());
+	if (format.geometryOnly || std::all_of(materials.begin(), materials.end(), [&](uint32_t m) { return m == materials[0]; })) return 3;
+	const size_t perWord = std::all_of(materials.begin(), materials.end(), [](uint32_t m) { return m < 256; }) ? 4 : 2;
+	return 3 + (materials.size() + perWord - 1) / perWord;
+}
+
+uint32_t SVDAG::appendBrick(uint64_t occupancy, std::span<const uint32_t> materials) {
+	assert(!materials.empty() && size_t(std::popcount(occupancy)) == materials.size());
+	const auto index = uint32_t(nodes.size());
+	const size_t words = brickWords(materials);
+	const int perWord = words == 3 ? 0 : std::all_of(materials.begin(), materials.end(), [](uint32_t m) { return m < 256; }) ? 4 : 2;
+	uint32_t header = BrickFlag;
+	if (!format.geometryOnly) header |= perWord == 0 ? materials[0] << 8 | BrickUniform : perWord == 4 ? BrickPerVoxel8 : BrickPerVoxel;
+	nodes.push_back(int32_t(header));
+	nodes.push_back(int32_t(uint32_t(occupancy)));
+	nodes.push_back(int32_t(uint32_t(occupancy >> 32)));
+	nodes.resize(index + words, 0);
+	// ids in bit order from the lowest bits of the word after the occupancy on
+	for (size_t i = 0; perWord && i < materials.size(); i++) {
+		nodes[index + 3 + i / perWord] |= int32_t(materials[i] << (i % perWord * (32 / perWord)));
+	}
+	return index;
+}
+
+void SVDAG::makePointersRelative() {
+	assert(!format.relativePointers);
+	constexpr uint32_t IdMask = (1u << MirrorShift) - 1;
+	// nodes in their current order and the references between them
+	std::vector<size_t> starts;
+	for (size_t index = 0; index < nodes.size(); index += nodeWords(index)) starts.push_back(index);
+	auto nodeAt = [&](uint32_t index) {
+		return uint32_t(std::lower_bound(starts.begin(), starts.end(), index) - starts.begin());
+	};
+	auto childCount = [&](uint32_t node) {
+		return nodes[starts[node]] < 0 ? 0 : std::popcount(uint32_t(nodes[starts[node]]) & 255);
+	};
+	const auto count = uint32_t(starts.size());
+	std::vector<uint32_t> firstChild(count + 1), children, references(count);
+	for (uint32_t node = 0; node < count; node++) {
+		firstChild[node] = uint32_t(children.size());
+		for (int slot = 0; slot < childCount(node); slot++) {
+			const uint32_t child = nodeAt(uint32_t(nodes[starts[node] + 1 + slot]) & IdMask);
+			children.push_back(child);
+			references[child]++;
+		}
+	}
+	firstChild[count] = uint32_t(children.size());
+
+	// the deepest level of every node, visiting a node once all of its parents are done
+	std::vector<uint32_t> level(count), waiting(references), queue;
+	for (uint32_t node = 0; node < count; node++) {
+		if (!references[node]) queue.push_back(node); // the root of every frame
+	}
+	for (size_t i = 0; i < queue.size(); i++) {
+		const uint32_t node = queue[i];
+		for (uint32_t c = firstChild[node]; c < firstChild[node + 1]; c++) {
+			level[children[c]] = std::max(level[children[c]], level[node] + 1);
+			if (--waiting[children[c]] == 0) queue.push_back(children[c]);
+		}
+	}
+	assert(queue.size() == count);
+	std::vector<uint32_t> order(count);
+	std::iota(order.begin(), order.end(), 0);
+	std::stable_sort(order.begin(), order.end(), [&](uint32_t a, uint32_t b) {
+		return level[a] != level[b] ? level[a] < level[b] : references[a] > references[b];
+	});
+
+	// Far pointers make their nodes larger and can push other children out of range,
+	// so this is repeated until no more pointers turn far. Offsets only ever grow.
+	const uint32_t nearLimit = 1u << nearBits();
+	std::vector<bool> far(children.size());
+	std::vector<uint32_t> position(count);
+	levelStarts.assign(level[order.back()] + 1, 0);
+	auto words = [&](uint32_t node) -> size_t {
+		if (nodes[starts[node]] < 0) return nodeWords(starts[node]);
+		const int n = childCount(node);
+		const size_t fars = std::count(far.begin() + firstChild[node], far.begin() + firstChild[node + 1], true);
+		return 1 + (n + 1) / 2 + (format.geometryOnly && n ? n - 1 : 0) + fars;
+	};
+	for (bool changed = true; changed;) {
+		size_t next = 0;
+		for (uint32_t i = 0; i < count; i++) {
+			if (i == 0 || level[order[i]] != level[order[i - 1]]) levelStarts[level[order[i]]] = uint32_t(next);
+			position[order[i]] = uint32_t(next);
+			next += words(order[i]);
+		}
+		assert(next <= IdMask);
+		changed = false;
+		for (uint32_t node = 0; node < count; node++) {
+			for (uint32_t c = firstChild[node]; c < firstChild[node + 1]; c++) {
+				const uint32_t child = children[c];
+				if (!far[c] && (level[child] != level[node] + 1 || position[child] - levelStarts[level[child]] >= nearLimit)) {
+					changed = far[c] = true;
+				}
+			}
+		}
+	}
+
+	std::vector<int32_t> result;
+	for (const auto node : order) {
+		const size_t from = starts[node];
+		assert(result.size() == position[node]);
+		result.push_back(nodes[from]);
+		if (nodes[from] < 0) {
+			result.insert(result.end(), nodes.begin() + from + 1, nodes.begin() + from + nodeWords(from));
+			continue;
+		}
+		const int n = childCount(node);
+		const size_t entries = result.size();
+		result.resize(entries + (n + 1) / 2, 0);
+		if (format.geometryOnly && n) result.insert(result.end(), nodes.begin() + from + 1 + n, nodes.begin() + from + 2 * n);
+		uint32_t fars = 0;
+		for (int slot = 0; slot < n; slot++) {
+			const uint32_t c = firstChild[node] + slot, mirror = uint32_t(nodes[from + 1 + slot]) >> MirrorShift;
+			uint32_t entry;
+			if (far[c]) {
+				entry = FarFlag | fars++;
+				result.push_back(int32_t(position[children[c]] | mirror << MirrorShift));
+			}
+			else {
+				assert(mirror < 1u << (15 - nearBits()));
+				entry = (position[children[c]] - levelStarts[level[children[c]]]) | mirror << nearBits();
+			}
+			result[entries + slot / 2] |= int32_t(entry << (slot % 2 * 16));
+		}
+	}
+	nodes = std::move(result);
+	format.relativePointers = true;
+	rootIndex = position[nodeAt(rootIndex)];
+	for (auto& root : frameRoots) root = position[nodeAt(root)];
+}
+
+size_t SVDAG::hostBytes() const noexcept {
+	return sizeof(SVDAG) + nodes.capacity() * sizeof(int32_t) + materials.capacity() * sizeof(SVO::Material) +
+		attributeStarts.capacity() * sizeof(uint32_t) + attributeMaterials.capacity() * sizeof(uint16_t) +
+		lodColors.capacity() * sizeof(uint32_t) + levelStarts.capacity() * sizeof(uint32_t) + frameRoots.capacity() * sizeof(uint32_t);
+}
+
+void SVDAG::shrinkToFit() {
+	nodes.shrink_to_fit();
+	materials.shrink_to_fit();
+	attributeStarts.shrink_to_fit();
+	attributeMaterials.shrink_to_fit();
+	lodColors.shrink_to_fit();
+	levelStarts.shrink_to_fit();
+	frameRoots.shrink_to_fit();
+}
+
+size_t SVDAG::wordsBelow(uint32_t root) const {
+	constexpr uint32_t IdMask = (1u << MirrorShift) - 1;
+	std::vector<bool> visited(nodes.size());
+	std::vector<std::pair<uint32_t, int>> stack{ { root, format.relativePointers ? levelOf(root) : 0 } };
+	size_t words = 0;
+	while (!stack.empty()) {
+		const auto [index, level] = stack.back();
+		stack.pop_back();
+		if (visited[index]) continue;
+		visited[index] = true;
+		words += nodeWords(index);
+		if (nodes[index] < 0) continue; // a brick
+		for (int slot = 0; slot < std::popcount(uint32_t(nodes[index]) & 255); slot++) {
+			int childLevel = level;
+			const uint32_t child = this->child(index, slot, childLevel) & IdMask;
+			stack.push_back({ child, childLevel });
+		}
+	}
+	return words;
+}
+
+std::vector<size_t> SVDAG::pointerWidths() const {
+	std::vector<size_t> widths(33);
+	for (size_t index = 0; index < nodes.size(); index += nodeWords(index)) {
+		if (nodes[index] < 0) continue;
+		const int count = std::popcount(uint32_t(nodes[index]) & 255);
+		for (int slot = 0; slot < count; slot++) {
+			const uint32_t entry = uint32_t(nodes[index + 1 + slot / 2]) >> (slot % 2 * 16) & 0xffff;
+			if (!format.relativePointers || entry & FarFlag) widths[32]++;
+			else widths[std::bit_width(entry & ((1u << nearBits()) - 1))]++;
+		}
+	}
+	return widths;
+}
+
+void SVDAG::forEachVoxel(const std::function<void(uint32_t x, uint32_t y, uint32_t z, const SVO::Material& material)>& voxel) const {
+	Decoder{ *this, voxel }.node(int32_t(rootIndex), 0, 0, 0, 0, 0, uint32_t(rootSize));
+}
@@ -0,0 +1,133 @@
+#pragma once
+#include <vector>
+#include <functional>
+#include <span>
+#include "SVO.h"
+
+// how SVDAG::nodes is encoded
+struct SVDAGFormat {
+	// store the lowest two levels as 4x4x4 leaf bricks where they are smaller
+	bool leafBricks = true;
+	// store no materials in the nodes, see SVDAG::attributeStarts
+	bool geometryOnly = false;
+	// merge subtrees that are mirror images of each other, the highest 3 bits of a child
+	// index are then the mirror along x, y and z applied to the child (see DAGNode).
+	// Can't be combined with geometryOnly, as mirroring changes the traversal order.
+	bool symmetry = false;
+	// store children as 16 bit offsets within the next level, see SVDAG::FarFlag
+	bool relativePointers = false;
+
+	bool operator==(const SVDAGFormat& other) const = default;
+};
+
+// the arrays of an SVDAG that are uploaded to the GPU, wherever they are stored (see SVDAGFile)
+struct SVDAGBuffers {
+	std::span<const int32_t> nodes;
+	std::span<const SVO::Material> materials;
+	std::span<const uint32_t> attributeStarts;
+	std::span<const uint16_t> attributeMaterials;
+	std::span<const uint32_t> lodColors;
+};
+
+// The SVDAG in the layout uploaded to the GPU (see README.md).
+struct SVDAG {
+	static constexpr int MirrorShift = 29; // child indices are below 1 << MirrorShift
+	// the largest rootSize the shader traverses, whose stack holds a node of every level
+	// from the root down to a voxel (MAX_LEVELS in compute.glsl)
+	static constexpr size_t MaxRootSize = size_t(1) << 23;
+
+	std::vector<int32_t> nodes;
+	std::vector<SVO::Material> materials;
+	// With format.geometryOnly, nodes only describe the geometry and are followed by the
+	// number of voxels in the subtrees of all but their first child, so that the traversal
+	// can count the voxels before the one it hits. Their materials are stored as runs
+	// in traversal (Morton) order instead: voxels from attributeStarts[i] up to the next
+	// start are of materials[attributeMaterials[i]].
+	std::vector<uint32_t> attributeStarts;
+	std::vector<uint16_t> attributeMaterials;
+	// The average colour (red, green and blue in the lowest bytes), SVO::Material::Water if it holds
+	// any water, and the coverage (the fraction of filled voxels in the highest 7 bits) of the
+	// subtree of every interior node, which the traversal takes as a hit instead of descending into
+	// nodes that are smaller than a pixel, unless they hold water, which has to refract.
+	// Interior nodes store the index of theirs in place of a material, or 0 (never used) if
+	// they have none, as after edits. Empty with format.geometryOnly, where differently
+	// coloured subtrees share nodes.
+	std::vector<uint32_t> lodColors;
+	SVDAGFormat format;
+	size_t rootSize = 0;
+	size_t nodeCount = 0; // number of unique nodes stored in `nodes`
+	uint32_t rootIndex = 0; // moves to the end of `nodes` with every edit
+	// The roots of the frames of an animation, which share all of their nodes that are the same,
+	// so a frame is shown by making its root the rootIndex. Empty if there is a single frame.
+	std::vector<uint32_t> frameRoots;
+	// Nodes of BrickSize can be stored as leaf bricks instead: a header of
+	// (BrickFlag | material id << 8 | brick kind), two words of occupancy where bit i
+	// is the voxel with the Morton code i within the brick, and for BrickPerVoxel
+	// the 16 bit material id of every filled voxel in bit order, two per word. Bricks
+	// whose ids are all below 256, as those of a .vox palette, are BrickPerVoxel8 with
+	// 8 bit ids, four per word.
+	static constexpr uint32_t BrickSize = 4;
+	static constexpr uint32_t BrickFlag = 1u << 31;
+	static constexpr int BrickUniform = 0, BrickPerVoxel = 1, BrickPerVoxel8 = 2;
+	// With format.relativePointers the nodes are laid out level by level from levelStarts, and
+	// the children of a node are 16 bit entries, two per word starting in the low half, followed
+	// by the voxel counts of format.geometryOnly and then by the far pointers of the node. An entry
+	// is the offset of the child from the start of the next level in the lowest nearBits() and its
+	// mirror above them, or FarFlag | the number of the far pointer for children that are out of
+	// range or not on the next level. Far pointers are stored like absolute child indices.
+	static constexpr uint32_t FarFlag = 1u << 15;
+	std::vector<uint32_t> levelStarts;
+	int nearBits() const noexcept { return format.symmetry ? 12 : 15; }
+
+	SVDAGBuffers buffers() const noexcept { return { nodes, materials, attributeStarts, attributeMaterials, lodColors }; }
+	// the host memory taken by the arrays, including what they have reserved
+	size_t hostBytes() const noexcept;
+	// frees what the arrays have reserved beyond their size, as after building
+	void shrinkToFit();
+
+	// appends `material` for the voxels from traversal index `start` on
+	void appendAttribute(uint32_t start, uint32_t material) {
+		if (!attributeMaterials.empty() && attributeMaterials.back() == material) return;
+		attributeStarts.push_back(start);
+		attributeMaterials.push_back(uint16_t(material));
+	}
+
+	// Returns (index | mirror << MirrorShift) of the child in `slot` of the node at `index`
+	// and sets `level` to the level of the child in the layout of format.relativePointers.
+	uint32_t child(size_t index, int slot, int& level) const;
+	int levelOf(size_t index) const;
+	// returns the number of words of the node or brick at `index`
+	size_t nodeWords(size_t index) const;
+	// returns the material id of the filled voxel `rank` (in bit order) of the brick at `index`
+	uint32_t brickMaterial(size_t index, int rank) const;
+	// Returns the number of words of a brick of voxels with the material ids `materials` in bit
+	// order, which must be below 1 << 16 unless they are all the same. A brick has at least one voxel.
+	size_t brickWords(std::span<const uint32_t> materials) const;
+	// appends that brick with the smallest ids that fit and returns its index
+	uint32_t appendBrick(uint64_t occupancy, std::span<const uint32_t> materials);
+	// Lays the nodes out level by level and switches to format.relativePointers. Nodes are
+	// placed at their deepest level and the most referenced nodes of a level come first, so
+	// that most children are within reach of a 16 bit offset.
+	void makePointersRelative();
+	// returns the number of words of the nodes that can be reached from the node at `root`
+	size_t wordsBelow(uint32_t root) const;
+	// Returns how many child pointers need how many bits: the offset within the level for
+	// format.relativePointers and 32 bits for far and absolute pointers.
+	std::vector<size_t> pointerWidths() const;
+
+	// Edits copy the nodes on the paths to the changed voxels to the end of `nodes` and make
+	// the copy of the root the new root, so the words before stay untouched and only the new
+	// ones need to be uploaded. Boxes are [min, max). Returns if anything changed. Not
+	// supported with format.geometryOnly or format.relativePointers.
+	bool set(uint32_t x, uint32_t y, uint32_t z, const SVO::Material& material) {
+		return setBox({ x, y, z }, { x + 1, y + 1, z + 1 }, material);
+	}
+	bool clear(uint32_t x, uint32_t y, uint32_t z) {
+		return clearBox({ x, y, z }, { x + 1, y + 1, z + 1 });
+	}
+	bool setBox(glm::uvec3 min, glm::uvec3 max, const SVO::Material& material);
+	bool clearBox(glm::uvec3 min, glm::uvec3 max);
+
+	// Decodes the DAG again and calls `voxel` for every filled voxel in Morton order.
+	void forEachVoxel(const std::function<void(uint32_t x, uint32_t y, uint32_t z, const SVO::Material& material)>& voxel) const;
+};
@@ -0,0 +1,124 @@
+#include "SVDAGFile.h"
+#include <fstream>
+#include <iostream>
+#include <cstring>
+#include <algorithm>
+#include <bit>
+#include <span>
+
+static_assert(sizeof(SVO::Material) == 4, "materials are stored as they are uploaded");
+
+static size_t padded(size_t bytes) { return (bytes + 7) & ~size_t(7); }
+
+bool SVDAGFile::save(const SVDAG& svdag, const char* filename) {
+	Header header{};
+	header.magic = Magic;
+	header.version = Version;
+	header.leafBricks = svdag.format.leafBricks;
+	header.geometryOnly = svdag.format.geometryOnly;
+	header.symmetry = svdag.format.symmetry;
+	header.relativePointers = svdag.format.relativePointers;
+	header.rootIndex = svdag.rootIndex;
+	header.rootSize = svdag.rootSize;
+	header.nodeCount = svdag.nodeCount;
+	header.nodeWords = svdag.nodes.size();
+	header.materials = svdag.materials.size();
+	header.attributeRuns = svdag.attributeStarts.size();
+	header.lodColors = svdag.lodColors.size();
+	header.frames = svdag.frameRoots.size();
+	header.levels = uint32_t(svdag.levelStarts.size());
+	std::copy(svdag.levelStarts.begin(), svdag.levelStarts.end(), header.levelStarts);
+	const auto widths = svdag.pointerWidths();
+	std::copy(widths.begin(), widths.end(), header.pointerWidths);
+
+	std::ofstream stream(filename, std::ios::binary);
+	const char zeros[8] = { 0 };
+	auto write = [&](const void* data, size_t bytes) {
+		stream.write(static_cast<const char*>(data), bytes);
+		stream.write(zeros, padded(bytes) - bytes);
+	};
+	write(&header, sizeof(header));
+	write(svdag.nodes.data(), svdag.nodes.size() * sizeof(int32_t));
+	write(svdag.materials.data(), svdag.materials.size() * sizeof(SVO::Material));
+	write(svdag.attributeStarts.data(), svdag.attributeStarts.size() * sizeof(uint32_t));
+	write(svdag.attributeMaterials.data(), svdag.attributeMaterials.size() * sizeof(uint16_t));
+	write(svdag.lodColors.data(), svdag.lodColors.size() * sizeof(uint32_t));
+	write(svdag.frameRoots.data(), svdag.frameRoots.size() * sizeof(uint32_t));
+	stream.close();
+	if (!stream) {
+		std::cerr << "Failed to write " << filename << std::endl;
+		return false;
+	}
+	return true;
+}
+
+SVDAGFile::SVDAGFile(const char* filename) {
+	auto mapped = std::make_unique<MappedFile>(filename);
+	if (!mapped->data()) {
+		std::cerr << "Failed to map " << filename << std::endl;
+		return;
+	}
+	Header header;
+	if (mapped->size() < sizeof(header)) {
+		std::cerr << filename << " is not an SVDAG" << std::endl;
+		return;
+	}
+	std::memcpy(&header, mapped->data(), sizeof(header));
+	if (header.magic != Magic || header.version != Version || header.levels > 32) {
+		std::cerr << filename << " is not an SVDAG of version " << Version << std::endl;
+		return;
+	}
+	// every count is checked against the file size first, so the offsets can't overflow
+	const uint64_t counts[] = { header.nodeWords, header.materials, header.attributeRuns, header.lodColors, header.frames };
+	if (std::any_of(std::begin(counts), std::end(counts), [&](uint64_t count) { return count > mapped->size(); })) {
+		std::cerr << filename << " is truncated" << std::endl;
+		return;
+	}
+	const size_t nodes = sizeof(header), materials = nodes + padded(header.nodeWords * sizeof(int32_t)),
+		starts = materials + padded(header.materials * sizeof(SVO::Material)),
+		runs = starts + padded(header.attributeRuns * sizeof(uint32_t)),
+		lods = runs + padded(header.attributeRuns * sizeof(uint16_t)),
+		frames = lods + padded(header.lodColors * sizeof(uint32_t)),
+		end = frames + header.frames * sizeof(uint32_t);
+	if (mapped->size() < end) {
+		std::cerr << filename << " is truncated" << std::endl;
+		return;
+	}
+	// the shader follows the roots and level starts without checking them
+	const char* data = mapped->data();
+	const auto frameRoots = std::span(reinterpret_cast<const uint32_t*>(data + frames), header.frames);
+	const auto inNodes = [&](uint32_t index) { return index < header.nodeWords; };
+	if (!inNodes(header.rootIndex) || !std::all_of(frameRoots.begin(), frameRoots.end(), inNodes) ||
+		!std::is_sorted(header.levelStarts, header.levelStarts + header.levels) ||
+		(header.levels && header.levelStarts[header.levels - 1] > header.nodeWords) ||
+		!std::has_single_bit(header.rootSize) || header.rootSize > SVDAG::MaxRootSize ||
+		header.levels > uint64_t(std::bit_width(header.rootSize)) || header.nodeCount > header.nodeWords) {
+		std::cerr << filename << " is corrupt" << std::endl;
+		return;
+	}
+
+	info.format = { bool(header.leafBricks), bool(header.geometryOnly), bool(header.symmetry), bool(header.relativePointers) };
+	info.rootIndex = header.rootIndex;
+	info.rootSize = header.rootSize;
+	info.nodeCount = header.nodeCount;
+	info.levelStarts.assign(header.levelStarts, header.levelStarts + header.levels);
+	info.frameRoots.assign(frameRoots.begin(), frameRoots.end());
+	pointerWidths.assign(std::begin(header.pointerWidths), std::end(header.pointerWidths));
+	// mappings are page aligned and every array starts at a multiple of 8 bytes
+	buffers.nodes = { reinterpret_cast<const int32_t*>(data + nodes), header.nodeWords };
+	buffers.materials = { reinterpret_cast<const SVO::Material*>(data + materials), header.materials };
+	buffers.attributeStarts = { reinterpret_cast<const uint32_t*>(data + starts), header.attributeRuns };
+	buffers.attributeMaterials = { reinterpret_cast<const uint16_t*>(data + runs), header.attributeRuns };
+	buffers.lodColors = { reinterpret_cast<const uint32_t*>(data + lods), header.lodColors };
+	file = std::move(mapped);
+}
+
+SVDAG SVDAGFile::toSVDAG() const {
+	SVDAG result = info;
+	result.nodes.assign(buffers.nodes.begin(), buffers.nodes.end());
+	result.materials.assign(buffers.materials.begin(), buffers.materials.end());
+	result.attributeStarts.assign(buffers.attributeStarts.begin(), buffers.attributeStarts.end());
+	result.attributeMaterials.assign(buffers.attributeMaterials.begin(), buffers.attributeMaterials.end());
+	result.lodColors.assign(buffers.lodColors.begin(), buffers.lodColors.end());
+	return result;
+}
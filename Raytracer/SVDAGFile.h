@@ -0,0 +1,42 @@
+#pragma once
+#include <memory>
+#include "SVDAG.h"
+#include "MappedFile.h"
+
+// An SVDAG saved as .svdag: a Header followed by the nodes, materials, attribute starts,
+// attribute materials and LOD colors exactly as they are uploaded to the GPU and the frame
+// roots, each starting at a multiple of 8 bytes. Numbers are stored little-endian as they are
+// in memory. The file is memory mapped when loaded, so the arrays are uploaded straight from
+// the mapping without being copied or built again.
+class SVDAGFile {
+public:
+	static constexpr uint32_t Magic = 'S' | 'V' << 8 | 'D' << 16 | 'G' << 24;
+	static constexpr uint32_t Version = 5;
+	struct Header {
+		uint32_t magic = Magic, version = Version;
+		uint8_t leafBricks, geometryOnly, symmetry, relativePointers; // SVDAGFormat
+		uint32_t rootIndex;
+		uint64_t rootSize, nodeCount;
+		uint64_t nodeWords, materials, attributeRuns, lodColors, frames;
+		uint32_t levels, levelStarts[32]; // SVDAG::levelStarts
+		uint64_t pointerWidths[33]; // SVDAG::pointerWidths()
+	};
+
+	// returns if `svdag` was written to `filename`
+	static bool save(const SVDAG& svdag, const char* filename);
+
+	// maps `filename`, check valid() before using the rest, which is false if its header
+	// doesn't fit the file
+	explicit SVDAGFile(const char* filename);
+	bool valid() const noexcept { return file != nullptr; }
+
+	// returns a copy of the SVDAG in memory
+	SVDAG toSVDAG() const;
+
+	SVDAG info; // the SVDAG without nodes, materials, attributes and LOD colors, but with its frame roots
+	SVDAGBuffers buffers;
+	std::vector<size_t> pointerWidths;
+
+private:
+	std::unique_ptr<MappedFile> file;
+};
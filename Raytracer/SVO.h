@@ -1,55 +1,74 @@
 #pragma once
 #include <memory>
+#include <cassert>
+#include <bit>
 #include <vector>
 #include <unordered_map>
 #include <glm/glm.hpp>
 
+struct SVDAG;
+struct SVDAGFormat;
 
 
 class SVO {
 public:
+	// red, green and blue in the lowest bytes and the flags in the highest one, as uploaded to the GPU
 	struct Material {
-		glm::uvec3 color;
-		unsigned int water = 0;
-		bool operator==(const Material& other) const noexcept {
-			return color == other.color && water == other.water;
-		}
+		static constexpr uint32_t Water = 1u << 24;
+		uint32_t packed = 0;
+
+		Material(glm::uvec3 color = { 0, 0, 0 }, bool water = false) noexcept
+			: packed((color.r & 255) | (color.g & 255) << 8 | (color.b & 255) << 16 | (water ? Water : 0)) {}
+		glm::uvec3 color() const noexcept { return { packed & 255, packed >> 8 & 255, packed >> 16 & 255 }; }
+		bool water() const noexcept { return packed & Water; }
+		bool operator==(const Material& other) const noexcept { return packed == other.packed; }
 	};
 
-	SVO(size_t size) : size(size) {}
+	// `size` must be a power of two
+	SVO(size_t size) : size(size) { assert(std::has_single_bit(size)); allocate(); /* root */ }
 	SVO(SVO&) = delete;
 	SVO(SVO&&) = delete;
-	~SVO() { for (auto& child : children) delete child; }
+	~SVO() = default;
 	SVO& operator=(SVO&) = delete;
 	SVO& operator=(SVO&&) = delete;
 
 	void set(size_t x, size_t y, size_t z, glm::uvec3 rgb, bool water = false);
-	void toSVDAG(std::vector<int32_t>& svdag, std::vector<Material>& materials);
+	void toSVDAG(SVDAG& result, const SVDAGFormat& format);
 
-	size_t hash();
 	size_t getSize() const noexcept { return size; }
 
 	static SVO* sample();
-	static SVO* terrain(int size);
-	static SVO* stair(int size);
-	static SVO* fromVox(const char* filename);
 
-private:
 	struct MaterialHasher {
 		std::size_t operator() (const Material& mat) const {
-			std::hash<unsigned int> hasher;
-			return hasher((mat.color.r << 16) | (mat.color.g << 8) | (mat.color.b) | (mat.water << 24));
+			return std::hash<uint32_t>()(mat.packed);
 		}
 	};
 
-	void toSVDAGImpl(
-		std::vector<int32_t>& result,
-		std::vector<Material>& materials,
-		std::unordered_map<size_t, size_t>& hashToIndex,
-		std::unordered_map<Material, size_t, MaterialHasher>& materialToIndex
-	);
-	SVO* children[8] = { nullptr };
-	size_t hashValue = 0;
+private:
+
+	// Nodes are carved from fixed-size slabs owned by the tree and refer to
+	// their children by index, so building never calls new per node and the
+	// whole tree is released together with the slabs.
+	// Index 0 is always the root, which is never anyone's child, so a child
+	// index of 0 means "no child".
+	struct Node {
+		uint32_t children[8] = { 0 };
+		Material material = { {0, 0, 0} };
+	};
+	static constexpr size_t SlabShift = 14;
+	static constexpr size_t SlabSize = size_t(1) << SlabShift;
+
+	Node& node(uint32_t index) noexcept {
+		return slabs[index >> SlabShift][index & (SlabSize - 1)];
+	}
+	uint32_t allocate();
+	uint32_t child(uint32_t parent, int i);
+
+	// interns the subtree at `index` bottom-up and returns its id in the table
+	struct DAGConversion;
+	uint32_t toSVDAGImpl(uint32_t index, size_t size, DAGConversion& conversion);
+	std::vector<std::unique_ptr<Node[]>> slabs;
+	size_t nodeCount = 0;
 	size_t size = 0;
-	Material material = { {0, 0, 0} };
 };
@@ -1,81 +1,136 @@
 #pragma once
 #include "SVO.h"
+#include "DAGBuilder.h"
+#include "SVDAGFile.h"
+#include "DAGCache.h"
 #include <string>
+#include <atomic>
 
 class Scene {
 public:
-	virtual ~Scene() {}
-	virtual SVO* load(int param) = 0;
+	virtual ~Scene() { delete scene; }
+	virtual SVDAG* load(int param, const DAGBuilder::Options& options) = 0;
 	virtual const char* getDisplayName() = 0;
 	virtual bool hasParam() { return false; }
 	virtual const char* getParamName() { return nullptr; }
-	virtual void release() {}
+	// scenes that are memory mapped return their file instead of load()ing an SVDAG
+	virtual const SVDAGFile* map() { return nullptr; }
+	// returns if the SVDAG returned by load() was freed
+	virtual bool release() { return false; }
+	// if load() keeps its SVDAG and returns it again, so that it can be loaded ahead of being shown
+	virtual bool keepsLoaded() { return false; }
+	// "hit" or "miss" if the last load() went through DAGCache, null otherwise
+	virtual const char* getCacheStatus() { return nullptr; }
+	// frees the SVDAG kept from load() once it isn't shown, the next load() builds it again
+	void evict() { keep(nullptr); }
+	// bytes of the SVDAG that the scene keeps in host memory, can be read while it is loading
+	size_t hostBytes() const noexcept { return keptBytes.load(std::memory_order_relaxed); }
+
+protected:
+	// replaces the SVDAG the scene keeps with `svdag` and returns it
+	SVDAG* keep(SVDAG* svdag) {
+		if (svdag != scene) delete scene;
+		scene = svdag;
+		keptBytes = svdag ? svdag->hostBytes() : 0;
+		return svdag;
+	}
+	SVDAG* scene = nullptr;
+
+private:
+	std::atomic<size_t> keptBytes = 0;
 };
 
 class TestScene: public Scene {
 public:
 	TestScene() = default;
-	~TestScene() { delete scene; }
 	
-	SVO* load(int param) override {
-		return scene ? scene : (scene = SVO::sample());
+	SVDAG* load(int param, const DAGBuilder::Options& options) override {
+		std::unique_ptr<SVO> svo(SVO::sample());
+		auto svdag = new SVDAG();
+		svo->toSVDAG(*svdag, options.format);
+		return keep(svdag);
 	}
 
 	const char* getDisplayName() override {
 		return "Test";
 	}
-
-private:
-	SVO* scene = nullptr;
 };
 
 class TerrainScene : public Scene {
 public:
 	TerrainScene() = default;
-	~TerrainScene() { delete scene; }
-	SVO* load(int param) override {
-		if (scene) delete scene;
-		return scene = SVO::terrain(param);
+	SVDAG* load(int param, const DAGBuilder::Options& options) override {
+		keep(nullptr);
+		return keep(DAGBuilder::terrain(param, options));
 	}
 	const char* getDisplayName() override {
 		return "Terrain";
 	}
 	bool hasParam() override { return true; }
 	const char* getParamName() override { return "Size"; }
-	void release() override { delete scene; scene = nullptr; }
-private:
-	SVO* scene = nullptr;
 };
 
 class StairScene : public Scene {
 public:
 	StairScene() = default;
-	~StairScene() { delete scene; }
-	SVO* load(int param) override {
-		if (scene) delete scene;
-		return scene = SVO::stair(param);
+	SVDAG* load(int param, const DAGBuilder::Options& options) override {
+		keep(nullptr);
+		return keep(DAGBuilder::stair(param, options));
 	}
 	const char* getDisplayName() override {
 		return "Stair";
 	}
 	bool hasParam() override { return true; }
 	const char* getParamName() override { return "Size"; }
-private:
-	SVO* scene = nullptr;
 };
 
 
 class VoxModelScene : public Scene {
 public:
-	VoxModelScene(std::string path) : path(std::move(path)) {}
-	~VoxModelScene() { delete scene; }
-	SVO* load(int param) override {
-		return scene ? scene: (scene = SVO::fromVox(path.c_str()));
+	VoxModelScene(std::string path, bool animation = false) : path(std::move(path)), animation(animation) {}
+	SVDAG* load(int param, const DAGBuilder::Options& options) override {
+		// the built format can differ from the requested one, so compare what was requested
+		if (scene && options.format == loadedFormat) return scene;
+		keep(nullptr);
+		loadedFormat = options.format;
+		return keep(DAGCache::load(path.c_str(), options.format, [&] {
+			return animation ? DAGBuilder::animationFromVox(path.c_str(), options) : DAGBuilder::fromVox(path.c_str(), options);
+		}, cacheStats, animation));
+	}
+	bool keepsLoaded() override { return true; }
+	const char* getDisplayName() override {
+		return path.c_str();
+	}
+	const char* getCacheStatus() override { return cacheStats.hit ? "hit" : "miss"; }
+private:
+	std::string path;
+	bool animation;
+	DAGCache::Stats cacheStats;
+	SVDAGFormat loadedFormat; // of the kept SVDAG
+};
+
+// Every frame of a .vox animation as a root of the same SVDAG, so that the renderer switches
+// frames by changing the root it starts from (see SVDAG::frameRoots).
+class AnimatedVoxScene : public VoxModelScene {
+public:
+	AnimatedVoxScene(std::string path) : VoxModelScene(std::move(path), true) {}
+};
+
+// a scene saved with SVDAGFile::save
+class SVDAGFileScene : public Scene {
+public:
+	SVDAGFileScene(std::string path) : path(std::move(path)) {}
+	SVDAG* load(int param, const DAGBuilder::Options& options) override { return nullptr; }
+	const SVDAGFile* map() override {
+		if (!file) file = std::make_unique<SVDAGFile>(path.c_str());
+		return file->valid() ? file.get() : nullptr;
 	}
 	const char* getDisplayName() override {
 		return path.c_str();
 	}
+	// the GPU has its own copy
+	bool release() override { file = nullptr; return false; }
 private:
-	SVO* scene = nullptr;
+	std::unique_ptr<SVDAGFile> file;
 	std::string path;
 };
@@ -0,0 +1,79 @@
+#include "SceneLoader.h"
+#include <chrono>
+#include <utility>
+
+SceneLoader::SceneLoader() : worker([this] { run(); }) {}
+
+SceneLoader::~SceneLoader() {
+	{
+		std::lock_guard lock(mutex);
+		stopping = true;
+		requests.clear();
+	}
+	wake.notify_one();
+	worker.join();
+}
+
+void SceneLoader::load(Scene& scene, int param, const DAGBuilder::Options& options) {
+	{
+		std::lock_guard lock(mutex);
+		std::erase_if(requests, [](const Request& request) { return request.kind != Request::Evict; });
+		requests.push_back({ Request::Load, &scene, param, options, ++lastTicket });
+		wanted = &scene;
+		ready.reset();
+	}
+	wake.notify_one();
+}
+
+void SceneLoader::prefetch(Scene& scene, const DAGBuilder::Options& options) {
+	{
+		std::lock_guard lock(mutex);
+		requests.push_back({ Request::Prefetch, &scene, 0, options });
+	}
+	wake.notify_one();
+}
+
+void SceneLoader::evict(Scene& scene) {
+	{
+		std::lock_guard lock(mutex);
+		requests.push_back({ Request::Evict, &scene });
+	}
+	wake.notify_one();
+}
+
+std::optional<SceneLoader::Loaded> SceneLoader::poll() {
+	std::lock_guard lock(mutex);
+	if (ready) wanted = nullptr;
+	return std::exchange(ready, std::nullopt);
+}
+
+Scene* SceneLoader::loading() {
+	std::lock_guard lock(mutex);
+	return wanted;
+}
+
+void SceneLoader::run() {
+	std::unique_lock lock(mutex);
+	for (;;) {
+		wake.wait(lock, [&] { return stopping || !requests.empty(); });
+		if (stopping) return;
+		Request request = std::move(requests.front());
+		requests.pop_front();
+		lock.unlock();
+
+		if (request.kind == Request::Evict) {
+			request.scene->evict();
+			lock.lock();
+			continue;
+		}
+		const auto start = std::chrono::steady_clock::now();
+		stepProgress = 0;
+		request.options.progress = &stepProgress;
+		Loaded loaded{ request.scene };
+		if (!(loaded.file = request.scene->map())) loaded.svdag = request.scene->load(request.param, request.options);
+		loaded.milliseconds = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+		lock.lock();
+		if (request.kind == Request::Load && request.ticket == lastTicket) ready = loaded;
+	}
+}
@@ -0,0 +1,62 @@
+#pragma once
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <optional>
+#include <thread>
+#include "Scene.h"
+
+// Loads scenes on a worker thread, one at a time, so that the renderer keeps showing the old
+// scene until the new one is ready. Scene::load() and Scene::map() only run on the worker once
+// a scene was handed to it; what they return is handed back by poll() to be uploaded.
+class SceneLoader {
+public:
+	struct Loaded {
+		Scene* scene;
+		SVDAG* svdag = nullptr;         // returned by Scene::load()
+		const SVDAGFile* file = nullptr; // returned by Scene::map(), which is tried first
+		double milliseconds = 0;        // spent on the worker
+	};
+
+	SceneLoader();
+	SceneLoader(SceneLoader&) = delete;
+	~SceneLoader(); // waits for the scene that is being loaded
+	SceneLoader& operator=(SceneLoader&) = delete;
+
+	// Loads `scene` next. Only the scene of the last call is handed back, so the prefetches and
+	// loads that haven't started yet are dropped, but evictions are not.
+	void load(Scene& scene, int param, const DAGBuilder::Options& options);
+	// Loads `scene` once nothing else is waiting, but doesn't hand it back. Only worth it for
+	// scenes that keep what they load (see Scene::keepsLoaded).
+	void prefetch(Scene& scene, const DAGBuilder::Options& options);
+	// Frees what `scene` keeps from loading it (see Scene::evict) once the requests before are
+	// done, so that it can't happen while it is being loaded.
+	void evict(Scene& scene);
+	// returns the scene of the last load() once, when it is ready
+	std::optional<Loaded> poll();
+	// the scene of the last load() until poll() returned it, or null
+	Scene* loading();
+	// of the step the build is at, see DAGBuildOptions::progress
+	float progress() const noexcept { return stepProgress.load(std::memory_order_relaxed); }
+
+private:
+	struct Request {
+		enum Kind { Load, Prefetch, Evict } kind;
+		Scene* scene;
+		int param = 0;
+		DAGBuilder::Options options = {};
+		uint64_t ticket = 0; // of loads
+	};
+	void run();
+
+	std::mutex mutex;
+	std::condition_variable wake;
+	std::deque<Request> requests;
+	uint64_t lastTicket = 0;
+	Scene* wanted = nullptr; // of lastTicket, until poll() returned it
+	std::optional<Loaded> ready;
+	bool stopping = false;
+	std::atomic<float> stepProgress = 0;
+	std::thread worker;
+};
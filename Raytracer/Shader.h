@@ -20,6 +20,9 @@ public:
 	void setInt(const char* name, int value) const noexcept {
 		glUniform1i(glGetUniformLocation(program, name), value);
 	}
+	void setInts(const char* name, const int* values, int count) const noexcept {
+		glUniform1iv(glGetUniformLocation(program, name), count, values);
+	}
 	void setFloat(const char* name, float value) const noexcept {
 		glUniform1f(glGetUniformLocation(program, name), value);
 	}
@@ -3,7 +3,9 @@
 // https://github.com/Infinideastudio/NEWorld/blob/0.5.0/NEWorld.Game/Universe/World/TerrainGen/Noise.h
 // which is a project that I have worked on before
 
-#include <cstdlib>
+#include <cstdint>
+#include <cmath>
+#include <cassert>
 
 static constexpr double NoiseScaleX = 64;
 static constexpr double NoiseScaleZ = 64;
@@ -49,20 +51,57 @@ class Noise {
 		return total;
 	}
 public:
-	explicit Noise() {
-		srand(time(nullptr));
-		offsetX = rand();
-		offsetZ	= rand();
+	static constexpr int BatchSize = 256;
+
+	explicit Noise(uint32_t seed) :
+		offsetX(int(random(seed, -1, 0) & 0x7fff)), offsetZ(int(random(seed, -1, 1) & 0x7fff)) {}
+
+	// A counter-based random number: the same seed and column always give the same
+	// number, no matter in which order or on which thread the columns are generated.
+	static constexpr uint32_t random(uint32_t seed, int x, int z) {
+		uint64_t h = (uint64_t(uint32_t(x)) << 32 | uint32_t(z)) ^ uint64_t(seed) * 0x9E3779B97F4A7C15ull;
+		h ^= h >> 33;
+		h *= 0xff51afd7ed558ccdull;
+		h ^= h >> 33;
+		h *= 0xc4ceb9fe1a85ec53ull;
+		h ^= h >> 33;
+		return uint32_t(h);
 	}
 
-	int operator() (int x, int z) {
+	int operator() (int x, int z) const {
 		return static_cast<int>(
 			PerlinNoise2D(
 				x / NoiseScaleX + 0.125 + offsetX,
 				z / NoiseScaleZ + 0.125 + offsetZ
 			)) >> 2;
 	}
+
+	// Same as operator() for the columns x, [z, z + count), but the corners of a noise
+	// cell are only computed once for the run of columns in it, which leaves loops of
+	// interpolation that the compiler can vectorize.
+	void heights(int x, int z, int count, int* out) const {
+		assert(count <= BatchSize);
+		double totals[BatchSize] = { 0 }, noiseZ[BatchSize], scaledZ[BatchSize];
+		const double noiseX = x / NoiseScaleX + 0.125 + offsetX;
+		for (int i = 0; i < count; i++) noiseZ[i] = (z + i) / NoiseScaleZ + 0.125 + offsetZ;
+		double frequency = 1, amplitude = 1;
+		for (auto octave = 0; octave <= 4; octave++) {
+			const auto scaledX = noiseX * frequency;
+			const auto int_X = static_cast<int>(floor(scaledX));
+			const auto fractional_X = scaledX - int_X;
+			for (int i = 0; i < count; i++) scaledZ[i] = noiseZ[i] * frequency;
+			for (int first = 0, last; first < count; first = last) {
+				const auto int_Z = static_cast<int>(floor(scaledZ[first]));
+				for (last = first + 1; last < count && scaledZ[last] < int_Z + 1; last++);
+				const auto i1 = Interpolate(Base(int_X, int_Z), Base(int_X + 1, int_Z), fractional_X);
+				const auto i2 = Interpolate(Base(int_X, int_Z + 1), Base(int_X + 1, int_Z + 1), fractional_X);
+				for (int i = first; i < last; i++) totals[i] += Interpolate(i1, i2, scaledZ[i] - int_Z) * amplitude;
+			}
+			frequency *= 2;
+			amplitude /= 2.0;
+		}
+		for (int i = 0; i < count; i++) out[i] = static_cast<int>(totals[i]) >> 2;
+	}
 private:
 	int offsetX, offsetZ;
 };
-
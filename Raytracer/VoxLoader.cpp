@@ -1,22 +1,155 @@
 #include "VoxLoader.h"
 #define OGT_VOX_IMPLEMENTATION
-#include <fstream>
 #include "ogt_vox.h"
+#include <iostream>
+#include <algorithm>
 #include <vector>
-void loadVox(const char* filename, std::function<void(int x, int y, int z, glm::uvec3 color)> emit) {
-	std::fstream file(filename, std::ios::in | std::ios::binary);
-	std::vector<uint8_t> buffer(std::istreambuf_iterator<char>(file), {});
-
-	const ogt_vox_scene* scene = ogt_vox_read_scene(buffer.data(), buffer.size());
-	for (int i = 0; i < scene->num_models; ++i)
-	{
-		auto model = scene->models[i];
-		for (int x = 0; x < model->size_x;++x)
-			for (int y = 0; y < model->size_y;++y)
-				for (int z = 0; z < model->size_z;++z) {
-					auto data = model->voxel_data[ x+y*model->size_x + z*model->size_x	*model->size_y ]; // x->y->z order
-					auto rgb = scene->palette.color[data];
-					if (data) emit(x, z, y, { rgb.r, rgb.g, rgb.b });
+#include <cstring>
+#include <bit>
+#include <climits>
+#include <cmath>
+#include "MappedFile.h"
+
+VoxFile::VoxFile(const char* filename) {
+	// the scene is parsed into its own memory, so the mapping is only needed until then
+	MappedFile file(filename);
+	if (file.data()) scene = ogt_vox_read_scene_with_flags(reinterpret_cast<const uint8_t*>(file.data()), uint32_t(file.size()), k_read_scene_flags_keyframes);
+	if (!scene) {
+		std::cerr << "Failed to read " << filename << std::endl;
+		return;
+	}
+
+	// the model and transform of an instance can change at keyframes, which hold from there on
+	uint32_t frameCount = 1;
+	for (uint32_t i = 0; i < scene->num_instances; ++i) {
+		const auto& instance = scene->instances[i];
+		for (uint32_t k = 0; k < instance.model_anim.num_keyframes; k++) frameCount = std::max(frameCount, instance.model_anim.keyframes[k].frame_index + 1);
+		for (uint32_t k = 0; k < instance.transform_anim.num_keyframes; k++) frameCount = std::max(frameCount, instance.transform_anim.keyframes[k].frame_index + 1);
+	}
+	frames.resize(frameCount);
+
+	// bounds of every instance of every frame before the scene is moved
+	std::vector<std::vector<glm::ivec3>> mins(frameCount), maxs(frameCount);
+	glm::ivec3 sceneMin(INT_MAX, INT_MAX, INT_MAX), sceneMax(INT_MIN, INT_MIN, INT_MIN);
+	for (uint32_t frame = 0; frame < frameCount; frame++) {
+		for (uint32_t i = 0; i < scene->num_instances; ++i) {
+			const auto& instance = scene->instances[i];
+			if (instance.hidden || (instance.layer_index < scene->num_layers && scene->layers[instance.layer_index].hidden)) continue;
+			const uint32_t modelIndex = ogt_vox_sample_instance_model(&instance, frame);
+			const auto model = scene->models[modelIndex];
+			if (!model) continue;
+			const auto t = ogt_vox_sample_instance_transform(&instance, frame, scene);
+			// Rotations only permute and flip the axes. The model is centered on voxel size / 2,
+			// so voxel v is at floor(rotation * (v + 0.5 - size / 2) + translation).
+			const float columns[3][3] = { { t.m00, t.m01, t.m02 }, { t.m10, t.m11, t.m12 }, { t.m20, t.m21, t.m22 } };
+			const int size[3] = { int(model->size_x), int(model->size_y), int(model->size_z) };
+			float center[3] = { t.m30, t.m31, t.m32 };
+			for (int a = 0; a < 3; a++) {
+				for (int c = 0; c < 3; c++) center[c] += columns[a][c] * (0.5f - float(size[a] / 2));
+			}
+			// with y up
+			static constexpr int Up[3] = { 0, 2, 1 };
+			Instance placed{ modelIndex };
+			glm::ivec3 min, max;
+			for (int c = 0; c < 3; c++) {
+				const int from = Up[c];
+				placed.offset[c] = int(std::floor(center[from]));
+				min[c] = max[c] = placed.offset[c];
+				for (int a = 0; a < 3; a++) {
+					placed.axes[a][c] = int(columns[a][from]);
+					const int reach = int(columns[a][from]) * (size[a] - 1);
+					(reach < 0 ? min : max)[c] += reach;
+				}
+				max[c]++;
+				sceneMin[c] = std::min(sceneMin[c], min[c]);
+				sceneMax[c] = std::max(sceneMax[c], max[c]);
+			}
+			frames[frame].push_back(placed);
+			mins[frame].push_back(min);
+			maxs[frame].push_back(max);
+		}
+	}
+	if (sceneMin.x == INT_MAX) return;
+
+	// Repeated models can only share nodes where they are aligned to cubes, so their alignment to
+	// the grid of the file is kept as far as the scene still fits into the same cube.
+	bool repeated = false;
+	for (const auto& instances : frames) {
+		std::vector<uint32_t> modelInstances(scene->num_models);
+		for (const auto& instance : instances) repeated |= ++modelInstances[instance.model] > 1;
+	}
+	if (repeated) {
+		const int size = int(std::bit_ceil(uint32_t(std::max({ sceneMax.x - sceneMin.x, sceneMax.y - sceneMin.y, sceneMax.z - sceneMin.z }))));
+		for (int c = 0; c < 3; c++) {
+			for (int cube = size; cube > 1; cube /= 2) {
+				const int aligned = sceneMin[c] >= 0 ? sceneMin[c] / cube * cube : -((-sceneMin[c] + cube - 1) / cube * cube);
+				if (sceneMax[c] - aligned <= size) {
+					sceneMin[c] = aligned;
+					break;
+				}
+			}
+		}
+	}
+	// every frame is moved by the same amount, so that they stay in place
+	for (uint32_t frame = 0; frame < frameCount; frame++) {
+		auto& instances = frames[frame];
+		for (size_t i = 0; i < instances.size(); i++) {
+			for (int c = 0; c < 3; c++) {
+				instances[i].offset[c] -= sceneMin[c];
+				instances[i].min[c] = uint32_t(mins[frame][i][c] - sceneMin[c]);
+				instances[i].max[c] = uint32_t(maxs[frame][i][c] - sceneMin[c]);
+			}
+		}
+	}
+}
+
+VoxFile::~VoxFile() {
+	if (scene) ogt_vox_destroy_scene(scene);
+}
+
+int VoxFile::size() const noexcept {
+	uint32_t size = 0;
+	for (const auto& instances : frames) {
+		for (const auto& instance : instances) size = std::max({ size, instance.max.x, instance.max.y, instance.max.z });
+	}
+	return int(size);
+}
+
+glm::uvec3 VoxFile::color(uint32_t index) const noexcept {
+	const auto& rgb = scene->palette.color[index];
+	return { rgb.r, rgb.g, rgb.b };
+}
+
+void VoxFile::forEachBatch(const Instance& instance, glm::uvec3 origin, const std::function<void(std::span<const Voxel> voxels)>& batch) const {
+	std::vector<Voxel> voxels;
+	voxels.reserve(BatchSize);
+	const auto model = scene->models[instance.model];
+	const uint32_t sizeX = model->size_x;
+	const glm::ivec3 step = instance.axes[0];
+	for (uint32_t z = 0; z < model->size_z; ++z) {
+		for (uint32_t y = 0; y < model->size_y; ++y) {
+			const uint8_t* row = model->voxel_data + (size_t(z) * model->size_y + y) * sizeX;
+			glm::ivec3 start;
+			for (int c = 0; c < 3; c++) start[c] = instance.axes[1][c] * int(y) + instance.axes[2][c] * int(z) + instance.offset[c] - int(origin[c]);
+			for (uint32_t x = 0; x < sizeX; ++x) {
+				// skip empty voxels 8 at a time, up to the first filled one
+				if (x + 8 <= sizeX) {
+					uint64_t word;
+					std::memcpy(&word, row + x, sizeof(word));
+					if (!word) {
+						x += 7;
+						continue;
+					}
+					x += (std::endian::native == std::endian::little ? std::countr_zero(word) : std::countl_zero(word)) / 8;
+				}
+				if (!row[x]) continue;
+				voxels.push_back({ uint32_t(start.x + step.x * int(x)), uint32_t(start.y + step.y * int(x)), uint32_t(start.z + step.z * int(x)), row[x] });
+				if (voxels.size() == BatchSize) {
+					batch(voxels);
+					voxels.clear();
 				}
+			}
+		}
 	}
+	if (!voxels.empty()) batch(voxels);
 }
@@ -1,6 +1,54 @@
 #pragma once
 
 #include <functional>
-#include <glm/vec3.hpp>
+#include <span>
+#include <vector>
+#include <cstdint>
+#include <glm/glm.hpp>
 
-extern void loadVox(const char* filename, std::function<void(int x, int y, int z, glm::uvec3 color)> emit);
+struct ogt_vox_scene;
+
+// A MagicaVoxel .vox file, mapped and parsed once. Its models are placed by the transforms
+// of their instances, which are flattened into the scene by ogt_vox. Animations have a frame
+// for every keyframe index up to the last one, in which the instances may use other models
+// or transforms.
+class VoxFile {
+public:
+	// a filled voxel with y up, and the index of its color in the palette
+	struct Voxel {
+		uint32_t x, y, z;
+		uint32_t color;
+	};
+	static constexpr size_t BatchSize = 1 << 14;
+
+	// A model placed in the scene with y up: voxel (x, y, z) of the model (with z up, as stored)
+	// is at axes[0] * x + axes[1] * y + axes[2] * z + offset. The scene is moved so that its
+	// bounds start at 0.
+	struct Instance {
+		uint32_t model;
+		glm::ivec3 axes[3];
+		glm::ivec3 offset;
+		glm::uvec3 min, max; // bounds in the scene, [min, max)
+	};
+
+	explicit VoxFile(const char* filename);
+	VoxFile(VoxFile&) = delete;
+	~VoxFile();
+	VoxFile& operator=(VoxFile&) = delete;
+
+	bool valid() const noexcept { return scene != nullptr; }
+	// the size of the cube that holds every instance of every frame, from the model headers
+	int size() const noexcept;
+	uint32_t frameCount() const noexcept { return uint32_t(frames.size()); }
+	glm::uvec3 color(uint32_t index) const noexcept;
+	// the instances that aren't hidden in `frame`
+	const std::vector<Instance>& getInstances(uint32_t frame = 0) const noexcept { return frames[frame]; }
+	// Calls `batch` with up to BatchSize filled voxels of `instance` at a time, at their place in
+	// the scene minus `origin` (which is at most instance.min). Voxels are in the order they are
+	// stored in the model, x fastest, then y.
+	void forEachBatch(const Instance& instance, glm::uvec3 origin, const std::function<void(std::span<const Voxel> voxels)>& batch) const;
+
+private:
+	const ogt_vox_scene* scene = nullptr;
+	std::vector<std::vector<Instance>> frames; // one if the scene isn't animated
+};
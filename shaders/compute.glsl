@@ -6,7 +6,15 @@
 #define PI 3.1415926535897932384626433832795
 #define MAX_BOUNCE 3
 #define MAX_RAYTRACE_DEPTH 4096
+#define MAX_LEVELS 24 // of the nodes from the root down to a voxel, up to a RootSize of 2^23 (SVDAG::MaxRootSize)
 #define DIFFUSION_PROB 0.5
+#define BRICK_SIZE 4
+#define BRICK_UNIFORM 0
+#define BRICK_PER_VOXEL 1
+#define BRICK_PER_VOXEL_8 2
+#define MATERIAL_WATER 0x1000000u
+#define MIRROR_SHIFT 29
+#define FAR_FLAG 0x8000
 
 // Types
 // =====
@@ -16,25 +24,29 @@ struct AABB {
   vec3 size;
 };
 
-struct Material {
-  uvec3 rgb;
-  uint water;
-};
-
 // Inputs
 // ======
 layout(local_size_x = 1, local_size_y = 1, local_size_z = 1) in;
 layout(rgba32f, binding = 0) uniform image2D imgOutput;
 layout(std430, binding = 1) buffer svdag { int svdagData[]; };
-layout(std430, binding = 2) buffer svdagMaterial {
-    Material materials[];
-};
+// red, green and blue in the lowest bytes and the flags (MATERIAL_WATER) in the highest, see SVO::Material
+layout(std430, binding = 2) buffer svdagMaterial { uint materials[]; };
 // output for length
 layout(std430, binding = 3) writeonly buffer AFBuffer {
 	float AutoFocusLength;
 };
+// materials of a geometry only SVDAG as runs in traversal order
+layout(std430, binding = 4) buffer svdagAttributeStarts { uint attributeStarts[]; };
+layout(std430, binding = 5) buffer svdagAttributeMaterials { uint attributeMaterials[]; }; // 16 bits each
+// average color, water flag and coverage of interior nodes, see SVDAG::lodColors
+layout(std430, binding = 6) buffer svdagLodColors { uint lodColors[]; };
 
 uniform int RootSize;
+uniform int RootIndex; // moves with every edit
+uniform bool GeometryOnly;
+// 0 for absolute child indices, otherwise the bits of relative ones (see SVDAG::FarFlag)
+uniform int NearPointerBits;
+uniform int LevelStarts[32]; // padded with the largest int
 uniform vec3 CameraPos, CameraFront, CameraUp;
 uniform vec3 RandomSeed;
 uniform int CurrentFrameCount;
@@ -42,6 +54,7 @@ uniform bool DepthOfField;
 uniform float FocalLength;
 uniform float LenRadius;
 uniform bool FastMode;
+uniform float LodBias; // pixels a node may cover before its LOD color is used, 0 to always descend
 
 uniform vec3 SunDir = normalize(vec3(-0.5, 0.75, 0.8));
 uniform vec3 SunColor = vec3(1, 1, 1);
@@ -80,16 +93,9 @@ vec3 randVec3() {
 // SVDAG & Raytracing
 // ===================
 
-// check if `pt` is inside `aabb`
-bool AABBInside(in vec3 pt, in AABB aabb) {
-  return all(greaterThanEqual(pt, aabb.min)) &&
-         all(lessThanEqual(pt, aabb.min + aabb.size));
-}
-
 // Returns (tNear, tFar), no intersection if tNear > tFar
 // slab method
-vec2 intersectAABB(vec3 rayOrigin, vec3 rayDir, in AABB box) {
-  vec3 invRayDir = 1.0 / rayDir;
+vec2 intersectAABB(vec3 rayOrigin, vec3 invRayDir, in AABB box) {
   vec3 tMin = (box.min - rayOrigin) * invRayDir;
   vec3 tMax = (box.min+box.size - rayOrigin) * invRayDir;
   vec3 t1 = min(tMin, tMax);
@@ -99,130 +105,203 @@ vec2 intersectAABB(vec3 rayOrigin, vec3 rayDir, in AABB box) {
   return vec2(tNear, tFar);
 }
 
-// returns the index of the subnode at `position` normalized as if the box is of
-// size 2
-int positionToIndex(in vec3 position) {
-  return int(position.x) * 4 + int(position.y) * 2 + int(position.z);
+// returns the material of the voxel with the traversal index `voxel` in a geometry only SVDAG
+uint attributeMaterial(uint voxel) {
+  // the last run starting at or before `voxel`
+  int lo = 0, hi = attributeStarts.length() - 1;
+  while (lo < hi) {
+    int mid = (lo + hi + 1) / 2;
+    if (attributeStarts[mid] <= voxel)
+      lo = mid;
+    else
+      hi = mid - 1;
+  }
+  return materials[(attributeMaterials[lo / 2] >> ((lo & 1) * 16)) & 0xFFFFu];
 }
 
-void transformAABB(in int childrenIndex, inout AABB box) {
-  box.size /= 2;
-  if (childrenIndex % 2 == 1) // 1,3,5,7
-    box.min.z += box.size.z;
-  if (childrenIndex == 2 || childrenIndex == 3 || childrenIndex == 6 ||
-      childrenIndex == 7)
-    box.min.y += box.size.y;
-  if (childrenIndex >= 4) // 4,5,6,7
-    box.min.x += box.size.x;
+// returns the Morton code of `p` within a box of `size`
+uint mortonCode(ivec3 p, int size) {
+  uint code = 0u;
+  for (int s = size >> 1; s > 0; s >>= 1)
+    code = code << 3 | uint((p.x & s) != 0) << 2 | uint((p.y & s) != 0) << 1 | uint((p.z & s) != 0);
+  return code;
 }
 
-// returns index of the node at `position`, and if its filled
-bool findNodeAt(in vec3 position, out bool filled, out AABB boxout, out Material mat) {
+// returns the level of the node at `index` in the layout of relative pointers
+int levelOf(int index) {
   int level = 0;
-  int index = 0;
-  AABB box = AABB(vec3(Epsilon), vec3(RootSize)); // initialize to root box
-  for (int i = 0; i < 32; ++i) {
-    int childrenIndex =
-        positionToIndex(2 * (position - box.min) / (RootSize >> level));
-    transformAABB(childrenIndex, box);
-
-    int bitmask = svdagData[index];
-
-    // if no children at all, this entire node is filled
-    if ((bitmask & 255) == 0) {
-      filled = true;
-      boxout = box;
-      mat = materials[bitmask >> 8];
-      return true;
-    }
-
-    // check if it has the specific children
-    if (((bitmask >> childrenIndex) & 1) == 1) {
-      index =
-          svdagData[index + 1 + bitCount(bitmask & ((1 << childrenIndex) - 1))];
-      level += 1;
-    } else {
-      filled = false;
-      boxout = box;
-      return true;
-    }
-  }
-  return false; // shouldn't be here
-}
-
-// returns -1 if close to 0, or 1 if close to boxSize, or 0 otherwise
-int normalHelper(float pt, float boxSize) {
-    return pt < Epsilon * 2 ? -1 : (pt > boxSize - Epsilon * 2 ? 1 : 0);
+  while (level < 31 && LevelStarts[level + 1] <= index)
+    level++;
+  return level;
 }
 
-int componentClosest(vec3 pt, float target) {
-    vec3 dist = abs(pt - target);
-    // if even the closest has a very large distance, then return -1 as mismatch
-    if (min(dist.x, min(dist.y, dist.z)) > Epsilon * 2) {
-		return -1;
-	}
-    if (dist.x < dist.y && dist.x < dist.z) {
-		return 0;
-	} else if(dist.y < dist.z) {
-		return 1;
-	} else {
-		return 2;
-	}
+// returns (index | mirror << MIRROR_SHIFT) of the child in `slot` of the node at `index`,
+// `level` is the level of the node in the layout of relative pointers and becomes that of the child
+int childAt(int index, int slot, int count, inout int level) {
+  if (NearPointerBits == 0)
+    return svdagData[index + 1 + slot];
+  int entry = (svdagData[index + 1 + slot / 2] >> (slot % 2 * 16)) & 0xFFFF;
+  if ((entry & FAR_FLAG) != 0) {
+    int child = svdagData[index + 1 + (count + 1) / 2 + (GeometryOnly ? count - 1 : 0) + (entry & ~FAR_FLAG)];
+    level = levelOf(child & ((1 << MIRROR_SHIFT) - 1));
+    return child;
+  }
+  level++;
+  return (LevelStarts[level] + (entry & ((1 << NearPointerBits) - 1))) | (entry >> NearPointerBits) << MIRROR_SHIFT;
 }
 
-vec3 getNormal(in vec3 pt, in AABB box) {
-    vec3 localized = pt - box.min;
-
-    int cMin = componentClosest(localized, 0);
-    if (cMin != -1) {
-        return vec3(cMin == 0 ? -1 : 0, cMin == 1 ? -1 : 0, cMin == 2 ? -1 : 0);
-    }
-    int cMax = componentClosest(localized, box.size.x);
-    return vec3(cMax == 0 ? 1 : 0, cMax == 1 ? 1 : 0, cMax == 2 ? 1 : 0);
+// returns if the voxel with the Morton code `i` in the leaf brick at `index` is filled,
+// and its material. `voxel` is the traversal index of the first voxel of the brick.
+bool brickVoxel(int index, int i, uint voxel, out uint mat) {
+  uint low = uint(svdagData[index + 1]), high = uint(svdagData[index + 2]);
+  if (((i < 32 ? low >> i : high >> (i - 32)) & 1u) == 0u)
+    return false;
+  int header = svdagData[index];
+  if (!GeometryOnly && (header & 255) == BRICK_UNIFORM) {
+    mat = materials[(header & 0x7FFFFFFF) >> 8];
+    return true;
+  }
+  // materials of the filled voxels are stored in bit order
+  int rank = i < 32 ? bitCount(low & ((1u << i) - 1u))
+                    : bitCount(low) + bitCount(high & ((1u << (i - 32)) - 1u));
+  if (GeometryOnly) {
+    mat = attributeMaterial(voxel + uint(rank));
+    return true;
+  }
+  if ((header & 255) == BRICK_PER_VOXEL_8) {
+    uint packed = uint(svdagData[index + 3 + rank / 4]);
+    mat = materials[(packed >> ((rank & 3) * 8)) & 0xFFu];
+  } else {
+    uint packed = uint(svdagData[index + 3 + rank / 2]);
+    mat = materials[(packed >> ((rank & 1) * 16)) & 0xFFFFu];
+  }
+  return true;
 }
 
-// return hit info
+// Returns if the ray hits a voxel, and its material, the normal of the face the ray entered it
+// through and a position just in front of that face. The nodes are walked with a stack from the
+// root down to the voxel the ray is in and back up only as far as the next one needs, and every
+// empty cube, as well as the voxels of leaf bricks, is stepped over at once along the integer
+// coordinates of the voxels, so no node is fetched again from the root. Nodes smaller than
+// `lodScale` times their distance are hit as a whole with the probability of their coverage.
 bool raytrace(
     in vec3 rayOri,
     in vec3 rayDir,
     out vec3 hitPosition,
     out vec3 normal,
-    out Material mat,
+    out uint mat,
     bool ignoreWater,
+    float lodScale,
     out vec3 lastRayOri
 ) {
-  vec3 ro = rayOri;
-  
-  lastRayOri = ro;
-
-  // place ro to inside the box first
-  vec2 t = intersectAABB(ro, rayDir, AABB(vec3(0), vec3(RootSize)));
+  lastRayOri = rayOri;
+  // the ray never leaves a voxel along an axis it is parallel to
+  vec3 dir = mix(rayDir, vec3(1e-20), equal(rayDir, vec3(0)));
+  vec3 invDir = 1.0 / dir;
+  ivec3 stepDir = ivec3(sign(dir));
+  ivec3 positive = ivec3(greaterThan(dir, vec3(0)));
+
+  vec2 t = intersectAABB(rayOri, invDir, AABB(vec3(0), vec3(RootSize)));
   if (t.x > t.y || t.y < 0) {
     return false;
   }
-  if (t.x > 0) ro += rayDir * (t.x + Epsilon);
-
-  for (int i = 0; i < MAX_RAYTRACE_DEPTH; i++) {
-    bool filled = false;
-    AABB box;
-    findNodeAt(ro, filled, box, mat);
-    
-    lastRayOri = ro;
+  float tCur = max(t.x, 0.0);
+  vec3 start = rayOri + rayDir * tCur;
+  // a start on a face of voxels is in the voxel the ray goes into
+  ivec3 cell = ivec3(floor(start));
+  cell -= ivec3(equal(vec3(cell), start)) * (1 - positive);
+  cell = clamp(cell, ivec3(0), ivec3(RootSize - 1));
+  // the axis of the face the ray entered the current voxel or cube through
+  vec3 tEntry = (vec3(cell + 1 - positive) - rayOri) * invDir;
+  int axis = tEntry.x > tEntry.y && tEntry.x > tEntry.z ? 0 : (tEntry.y > tEntry.z ? 1 : 2);
+
+  int levels = findMSB(RootSize);
+  float footprintScale = lodScale * length(rayDir);
+  // (index, mirror | layout level << 3, traversal index of the first voxel) of the nodes from
+  // the root down to the current one at `level`
+  ivec3 stack[MAX_LEVELS];
+  stack[0] = ivec3(RootIndex, 0, 0);
+  int level = 0;
+  for (int steps = 0; steps < MAX_RAYTRACE_DEPTH;) {
+    int index = stack[level].x;
+    int mirror = stack[level].y & 7; // the node is stored mirrored along x, y, z by bits 2, 1, 0
+    uint voxel = uint(stack[level].z);
+    int header = svdagData[index];
+    bool hit = false;
+    int skip; // the level of the cube around `cell` that is stepped over if nothing is hit
+
+    // leaf bricks have the highest bit set, their two levels are mirrored like the children index
+    if (header < 0) {
+      int code = int(mortonCode(cell & (BRICK_SIZE - 1), BRICK_SIZE)) ^ (mirror << 3 | mirror);
+      hit = brickVoxel(index, code, voxel, mat);
+      // an empty octant of the brick is stepped over as a whole
+      bool emptyOctant = ((uint(svdagData[index + 1 + code / 32]) >> (code & 24)) & 0xFFu) == 0u;
+      skip = emptyOctant ? level + 1 : level + 2;
+    }
+    // if no children at all, this entire node is filled. Uniform subtrees are collapsed
+    // into such nodes, so the node can be much larger than a voxel and is stepped over at once.
+    else if ((header & 255) == 0) {
+      if (GeometryOnly) {
+        int size = RootSize >> level;
+        mat = attributeMaterial(voxel + mortonCode(cell & (size - 1), size));
+      } else {
+        mat = materials[header >> 8];
+      }
+      hit = true;
+      skip = level;
+    }
+    // subtrees with water are descended into, as a LOD hit can't refract
+    else if (!GeometryOnly && (header >> 8) != 0 && float(RootSize >> level) < footprintScale * tCur &&
+             (lodColors[header >> 8] & MATERIAL_WATER) == 0u) {
+      uint color = lodColors[header >> 8];
+      hit = rand() * 127.0 < float(color >> 25);
+      mat = color & 0xFFFFFFu; // the coverage isn't a flag
+      skip = level;
+    }
+    else {
+      ivec3 octant = (cell >> (levels - level - 1)) & 1;
+      int stored = (octant.x << 2 | octant.y << 1 | octant.z) ^ mirror;
+      if (((header >> stored) & 1) == 1) {
+        int slot = bitCount(header & ((1 << stored) - 1));
+        int count = bitCount(header & 255);
+        // the voxels of the children before are stored after the children index
+        if (GeometryOnly && slot > 0)
+          voxel += uint(svdagData[index + (NearPointerBits == 0 ? count : (count + 1) / 2) + slot]);
+        int layoutLevel = stack[level].y >> 3;
+        int child = childAt(index, slot, count, layoutLevel);
+        level++;
+        stack[level] = ivec3(child & ((1 << MIRROR_SHIFT) - 1), (mirror ^ ((child >> MIRROR_SHIFT) & 7)) | layoutLevel << 3, int(voxel));
+        continue;
+      }
+      skip = level + 1;
+    }
 
-    // if that point is filled, then just return color
-    if (filled && (!ignoreWater || mat.water == 0)) {
-      normal = getNormal(ro, box);
-      hitPosition = ro - rayDir * Epsilon * 2 + normal * Epsilon;
+    if (hit && (!ignoreWater || (mat & MATERIAL_WATER) == 0u)) {
+      normal = vec3(0);
+      normal[axis] = float(-stepDir[axis]);
+      hitPosition = rayOri + rayDir * tCur;
+      // the face is exactly on the border of the voxel
+      hitPosition[axis] = float(cell[axis] + 1 - positive[axis]) + normal[axis] * Epsilon;
+      lastRayOri = hitPosition;
       return true;
     }
 
-    // otherwise, place ro to the next box. intersect inside aabb here
-    vec2 t = intersectAABB(ro, rayDir, box);
-    if (t.y < 0)
-      break;
-    ro += rayDir * (t.y + Epsilon);
-    if (ro.x > RootSize || ro.y > RootSize || ro.z > RootSize || ro.x < 0 || ro.y < 0 || ro.z < 0)
+    // step into the voxel behind the face the ray leaves the skipped cube through
+    int size = RootSize >> skip;
+    ivec3 cube = cell & ~(size - 1);
+    vec3 tExit = (vec3(cube + positive * size) - rayOri) * invDir;
+    axis = tExit.x < tExit.y && tExit.x < tExit.z ? 0 : (tExit.y < tExit.z ? 1 : 2);
+    tCur = max(tCur, tExit[axis]);
+    ivec3 next = clamp(ivec3(floor(rayOri + rayDir * tCur)), cube, cube + size - 1);
+    next[axis] = positive[axis] == 1 ? cube[axis] + size : cube[axis] - 1;
+    steps++;
+    lastRayOri = rayOri + rayDir * tCur;
+    if (next[axis] < 0 || next[axis] >= RootSize)
       break;
+    // back up to the node that holds both voxels
+    ivec3 diff = cell ^ next;
+    level = min(level, levels - 1 - findMSB(diff.x | diff.y | diff.z));
+    cell = next;
   }
   return false;
 }
@@ -282,17 +361,20 @@ vec3 shadeOnce(in vec3 rayOri, in vec3 rayDir) {
   vec3 hitPosition, hitNormal, hitLastRayOri;
   vec3 coef = vec3(1.0);
   vec3 hitPosUnused, hitNormalUnused, hitLastRayOriUnused;
-  Material mat, matUnused;
+  uint mat, matUnused;
   float curIR = 1; // air
+  // a pixel is about 1 / height radians wide, see getRay()
+  float lodScale = LodBias / float(gl_NumWorkGroups.y);
 
   for (int i = 0; i < MAX_BOUNCE; ++i) {
-      bool hit = raytrace(rayOri, rayDir, hitPosition, hitNormal, mat, abs(curIR-1)>Epsilon, hitLastRayOri);
+      // only camera rays are traced with LOD, as their footprint grows from the camera
+      bool hit = raytrace(rayOri, rayDir, hitPosition, hitNormal, mat, abs(curIR-1)>Epsilon, i == 0 ? lodScale : 0.0, hitLastRayOri);
             
-      vec3 objCol = vec3(mat.rgb) / 255.;
+      vec3 objCol = unpackUnorm4x8(mat).rgb;
       //return hitNormal/2+.5;
       if (FastMode) return objCol;
 
-      float newIR = hit ? (mat.water != 0 ? WaterIR : -1) : 1;
+      float newIR = hit ? ((mat & MATERIAL_WATER) != 0u ? WaterIR : -1) : 1;
       // no hit
       if (!hit) {
         if (abs(curIR - newIR) > Epsilon && i != MAX_BOUNCE - 1) {
@@ -303,7 +385,7 @@ vec3 shadeOnce(in vec3 rayOri, in vec3 rayDir) {
         return i == 0 ? SkyColor : dot(hitNormal, SunDir) * SunColor * objCol * coef;
       }
 
-      bool light = dot(hitNormal, SunDir) > 0 && !raytrace(hitPosition, SunDir, hitPosUnused, hitNormalUnused, matUnused, true, hitLastRayOri);
+      bool light = dot(hitNormal, SunDir) > 0 && !raytrace(hitPosition, SunDir, hitPosUnused, hitNormalUnused, matUnused, true, 0.0, hitLastRayOri);
       
       // last bounce
       if (i == MAX_BOUNCE - 1) {
@@ -385,8 +467,8 @@ void main() {
   // calculate distance for Auto Focus
   if (gl_GlobalInvocationID.xy == ivec2(gl_NumWorkGroups.xy) / 2) {
     vec3 hitPosition, hitNormal, hitLastRayOri;
-    Material mat;
-    if (raytrace(rayOri, rayDir, hitPosition, hitNormal, mat, false, hitLastRayOri)) {
+    uint mat;
+    if (raytrace(rayOri, rayDir, hitPosition, hitNormal, mat, false, 0.0, hitLastRayOri)) {
         AutoFocusLength = distance(hitPosition, CameraPos);
     }
   }